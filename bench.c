@@ -0,0 +1,551 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "inc/malloc.h"
+
+/*
+ * allocator benchmarks
+ * usage: ./bench_malloc [benchmark-name]   (no argument runs all of them)
+ */
+
+#define FS_THREADS 4
+#define FS_ITERATIONS 20000000
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+/*
+ * false sharing: one small counter per thread, allocated back to back so
+ * neighbouring counters land in the same zone. each thread then hammers its
+ * own counter; if two counters share a cache line the line ping-pongs
+ */
+static void *false_sharing_routine(void *arg)
+{
+    volatile long   *counter = arg;
+    long            i;
+
+    for (i = 0; i < FS_ITERATIONS; i++)
+        (*counter)++;
+    return NULL;
+}
+
+static void bench_false_sharing(void)
+{
+    pthread_t   threads[FS_THREADS];
+    long        *counters[FS_THREADS];
+    int         shared_lines = 0;
+    double      start;
+    int         i;
+
+    for (i = 0; i < FS_THREADS; i++)
+    {
+        counters[i] = malloc(sizeof(long));
+        *counters[i] = 0;
+    }
+    for (i = 1; i < FS_THREADS; i++)
+        if ((uintptr_t)counters[i] / CACHE_LINE == (uintptr_t)counters[i - 1] / CACHE_LINE)
+            shared_lines++;
+
+    start = now_seconds();
+    for (i = 0; i < FS_THREADS; i++)
+        pthread_create(&threads[i], NULL, false_sharing_routine, counters[i]);
+    for (i = 0; i < FS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    printf("false_sharing: threads=%d neighbours_sharing_a_line=%d time=%.3fs\n",
+        FS_THREADS, shared_lines, now_seconds() - start);
+
+    for (i = 0; i < FS_THREADS; i++)
+        free(counters[i]);
+}
+
+
+/*
+ * realloc growth: append a few bytes at a time to one buffer and count how
+ * often realloc had to move it
+ */
+#define GROWTH_STEP 8
+#define GROWTH_LIMIT (4 * 1024 * 1024)
+
+static void bench_realloc_growth(void)
+{
+    char    *buffer;
+    char    *grown;
+    size_t  size;
+    long    moves = 0;
+    double  start;
+
+    start = now_seconds();
+    buffer = NULL;
+    for (size = GROWTH_STEP; size <= GROWTH_LIMIT; size += GROWTH_STEP)
+    {
+        grown = realloc(buffer, size);
+        if (grown != buffer)
+            moves++;
+        buffer = grown;
+        buffer[size - 1] = 1;
+    }
+    printf("realloc_growth: final=%zu usable=%zu moves=%ld time=%.3fs\n",
+        (size_t)GROWTH_LIMIT, malloc_usable_size(buffer), moves, now_seconds() - start);
+    free(buffer);
+}
+
+
+/*
+ * worst-case latency: repeatedly build up and tear down a mixed working set
+ * and record the slowest single malloc/free, first with the default policy
+ * (zones are mapped and unmapped as the set grows and shrinks), then from a
+ * reserve-only thread with everything pre-faulted by malloc_reserve
+ */
+#define RT_ROUNDS 50
+#define RT_OBJECTS 2048
+#define RT_LARGE_SIZE (256 * 1024)
+#define RT_LARGE_EVERY 256
+
+static double now_ns(void)
+{
+    return (now_seconds() * 1e9);
+}
+
+static void rt_round(void **objects, double *worst_malloc, double *worst_free, long *failed)
+{
+    double  start;
+    double  elapsed;
+    size_t  size;
+    int     i;
+
+    for (i = 0; i < RT_OBJECTS; i++)
+    {
+        size = i % RT_LARGE_EVERY == 0 ? RT_LARGE_SIZE : (size_t)(16 + (i * 37) % 900);
+        start = now_ns();
+        objects[i] = malloc(size);
+        elapsed = now_ns() - start;
+        if (elapsed > *worst_malloc)
+            *worst_malloc = elapsed;
+        if (!objects[i])
+            (*failed)++;
+        else
+            ((volatile char *)objects[i])[size - 1] = 1;
+    }
+    for (i = 0; i < RT_OBJECTS; i++)
+    {
+        start = now_ns();
+        free(objects[i]);
+        elapsed = now_ns() - start;
+        if (elapsed > *worst_free)
+            *worst_free = elapsed;
+    }
+}
+
+static void rt_run(const char *label, int policy)
+{
+    static void *objects[RT_OBJECTS];
+    double      worst_malloc = 0;
+    double      worst_free = 0;
+    long        failed = 0;
+    int         round;
+
+    malloc_set_thread_policy(policy);
+    for (round = 0; round < RT_ROUNDS; round++)
+        rt_round(objects, &worst_malloc, &worst_free, &failed);
+    malloc_set_thread_policy(MALLOC_POLICY_DEFAULT);
+
+    printf("rt_latency: policy=%s worst_malloc=%.0fns worst_free=%.0fns failed=%ld\n",
+        label, worst_malloc, worst_free, failed);
+}
+
+static void bench_rt_latency(void)
+{
+    rt_run("default", MALLOC_POLICY_DEFAULT);
+    if (malloc_reserve(8, 32, RT_LARGE_SIZE, RT_OBJECTS / RT_LARGE_EVERY, 0) != 0)
+    {
+        printf("rt_latency: malloc_reserve failed\n");
+        return;
+    }
+    rt_run("reserve_only", MALLOC_POLICY_RESERVE_ONLY);
+}
+
+
+/*
+ * bulk zeroed buffers: calloc against malloc + memset for big buffers
+ * of which only the first page is used, as staging buffers often are
+ */
+#define BULK_SIZE (64UL * 1024 * 1024)
+#define BULK_ROUNDS 32
+
+/* keep the compiler from eliding the allocations or fusing malloc + memset */
+static void *volatile g_sink;
+static void *(*volatile g_memset)(void *, int, size_t) = memset;
+
+static void bench_calloc_bulk(void)
+{
+    char    *buffer;
+    double  start;
+    double  calloc_time;
+    int     i;
+
+    start = now_seconds();
+    for (i = 0; i < BULK_ROUNDS; i++)
+    {
+        buffer = calloc(1, BULK_SIZE);
+        g_sink = buffer;
+        buffer[0] = 1;
+        free(buffer);
+    }
+    calloc_time = now_seconds() - start;
+
+    start = now_seconds();
+    for (i = 0; i < BULK_ROUNDS; i++)
+    {
+        buffer = malloc(BULK_SIZE);
+        g_sink = buffer;
+        g_memset(buffer, 0, BULK_SIZE);
+        buffer[0] = 1;
+        free(buffer);
+    }
+    printf("calloc_bulk: size=%lu rounds=%d calloc=%.3fs malloc_memset=%.3fs\n",
+        BULK_SIZE, BULK_ROUNDS, calloc_time, now_seconds() - start);
+}
+
+
+/*
+ * fixed-size churn: the same 48-byte objects through malloc, a pool and a
+ * pool with magazines
+ */
+#define POOL_OBJECTS 1024
+#define POOL_ROUNDS 2000
+#define POOL_OBJ_SIZE 48
+
+static double pool_run(t_pool *pool)
+{
+    void    *objects[POOL_OBJECTS];
+    double  start;
+    int     round;
+    int     i;
+
+    start = now_seconds();
+    for (round = 0; round < POOL_ROUNDS; round++)
+    {
+        for (i = 0; i < POOL_OBJECTS; i++)
+            objects[i] = pool ? pool_alloc(pool) : malloc(POOL_OBJ_SIZE);
+        g_sink = objects[POOL_OBJECTS - 1];
+        for (i = POOL_OBJECTS - 1; i >= 0; i--)
+        {
+            if (pool)
+                pool_free(pool, objects[i]);
+            else
+                free(objects[i]);
+        }
+    }
+    return (now_seconds() - start);
+}
+
+static void bench_pool_churn(void)
+{
+    t_pool  *pool;
+    t_pool  *magazines;
+    double  malloc_time;
+
+    malloc_time = pool_run(NULL);
+    pool = pool_create(POOL_OBJ_SIZE, 0);
+    magazines = pool_create_flags(POOL_OBJ_SIZE, 0, POOL_MAGAZINES);
+    printf("pool_churn: objects=%d rounds=%d malloc=%.3fs pool=%.3fs pool_magazines=%.3fs\n",
+        POOL_OBJECTS, POOL_ROUNDS, malloc_time, pool_run(pool), pool_run(magazines));
+    pool_destroy(pool);
+    pool_destroy(magazines);
+}
+
+
+/*
+ * lifetime replay: a request server trace. every request allocates a few
+ * buffers that live until it completes, and now and then replaces a cache
+ * entry that lives much longer. bursts of concurrent requests grow the
+ * heap; once a burst drains, the zones it used can only be unmapped if no
+ * cache entry landed in them. run plain, with explicit hints and with
+ * call-site prediction, each in a fresh process
+ */
+#define REPLAY_ROUNDS 6
+#define REPLAY_BURST 256            // requests in flight during a burst
+#define REPLAY_CALM 16              // ... and between bursts
+#define REPLAY_REQUESTS 4000        // requests per round
+#define REPLAY_BUFFERS 8            // short-lived buffers per request
+#define REPLAY_CACHE 1024           // long-lived cache entries
+#define REPLAY_CACHE_EVERY 4        // requests per cache replacement
+
+typedef struct s_replay_request {
+    void    *buffers[REPLAY_BUFFERS];
+} t_replay_request;
+
+static unsigned int g_replay_seed;
+
+static unsigned int replay_rand(void)
+{
+    g_replay_seed = g_replay_seed * 1103515245 + 12345;
+    return (g_replay_seed >> 8);
+}
+
+/* resident set size in KB */
+static size_t rss_kb(void)
+{
+    FILE    *file;
+    size_t  pages = 0;
+    size_t  resident = 0;
+
+    file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return 0;
+    if (fscanf(file, "%zu %zu", &pages, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return (resident * (size_t)getpagesize() / 1024);
+}
+
+static void replay_request(t_replay_request *request, int hinted)
+{
+    size_t  size;
+    int     i;
+
+    for (i = 0; i < REPLAY_BUFFERS; i++)
+    {
+        size = 16 + replay_rand() % 1000;
+        request->buffers[i] = hinted ? malloc_hinted(size, MALLOC_HINT_SHORT_LIVED) : malloc(size);
+        ((volatile char *)request->buffers[i])[0] = 1;
+    }
+}
+
+static void replay_retire(t_replay_request *request)
+{
+    int     i;
+
+    for (i = 0; i < REPLAY_BUFFERS; i++)
+        free(request->buffers[i]);
+}
+
+static void replay_run(const char *label, int hinted, int predict)
+{
+    static t_replay_request requests[REPLAY_BURST];
+    static void             *cache[REPLAY_CACHE];
+    t_heap_report           report;
+    size_t                  zones_sum = 0;
+    size_t                  rss_sum = 0;
+    size_t                  slot;
+    size_t                  size;
+    double                  start;
+    int                     window;
+    int                     oldest;
+    int                     round;
+    int                     i;
+
+    g_replay_seed = 42;
+    malloc_lifetime_predict(predict);
+    start = now_seconds();
+    for (round = 0; round < REPLAY_ROUNDS; round++)
+    {
+        oldest = 0;
+        for (i = 0; i < REPLAY_REQUESTS; i++)
+        {
+            /* a burst at the start of every round, then a trickle */
+            window = i < REPLAY_REQUESTS / 4 ? REPLAY_BURST : REPLAY_CALM;
+            while (oldest + window <= i)
+                replay_retire(&requests[oldest++ % REPLAY_BURST]);
+            replay_request(&requests[i % REPLAY_BURST], hinted);
+
+            if (i % REPLAY_CACHE_EVERY == 0)
+            {
+                slot = replay_rand() % REPLAY_CACHE;
+                size = 32 + replay_rand() % 480;
+                free(cache[slot]);
+                cache[slot] = hinted ? malloc_hinted(size, MALLOC_HINT_LONG_LIVED) : malloc(size);
+            }
+        }
+        while (oldest < REPLAY_REQUESTS)
+            replay_retire(&requests[oldest++ % REPLAY_BURST]);
+
+        /* between bursts: what is still mapped for the cache alone */
+        malloc_analyze(NULL, &report, NULL);
+        zones_sum += report.zones[TINY] + report.zones[SMALL];
+        rss_sum += rss_kb();
+    }
+    printf("lifetime_replay: mode=%s zones_between_bursts=%zu rss_between_bursts=%zuKB time=%.3fs\n",
+        label, zones_sum / REPLAY_ROUNDS, rss_sum / REPLAY_ROUNDS, now_seconds() - start);
+
+    for (i = 0; i < REPLAY_CACHE; i++)
+        free(cache[i]);
+}
+
+static void bench_lifetime_replay(void)
+{
+    static const struct {
+        const char  *label;
+        int         hinted;
+        int         predict;
+    } modes[] = {{"plain", 0, 0}, {"hinted", 1, 0}, {"predicted", 0, 1}};
+    pid_t   pid;
+    size_t  i;
+
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0)
+        {
+            replay_run(modes[i].label, modes[i].hinted, modes[i].predict);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+    }
+}
+
+
+/*
+ * single-threaded TINY churn: malloc/free of one small block, while the
+ * process has one thread (locks skipped) and again after a thread was
+ * created. threads cannot be uncreated, so if earlier benchmarks started
+ * some the measurement runs in a freshly executed copy of this program
+ */
+#define SINGLE_ITERATIONS 20000000
+
+static void *single_idle_routine(void *arg)
+{
+    return arg;
+}
+
+static double single_run(void)
+{
+    double  start;
+    int     i;
+
+    start = now_seconds();
+    for (i = 0; i < SINGLE_ITERATIONS; i++)
+    {
+        g_sink = malloc(32);
+        free(g_sink);
+    }
+    return (now_seconds() - start);
+}
+
+static void bench_single_thread(void)
+{
+    pthread_t   thread;
+    double      single;
+    pid_t       pid;
+
+    if (!malloc_single_threaded())
+    {
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0)
+        {
+            execl("/proc/self/exe", "bench_malloc", "single_thread", (char *)NULL);
+            _exit(1);
+        }
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+        return;
+    }
+    single = single_run();
+    pthread_create(&thread, NULL, single_idle_routine, NULL);
+    pthread_join(thread, NULL);
+    printf("single_thread: iterations=%d unlocked=%.3fs locked=%.3fs\n",
+        SINGLE_ITERATIONS, single, single_run());
+}
+
+
+/*
+ * startup: launch a short-lived copy of this program that makes the
+ * allocations of a small command line tool and exits, with and without
+ * the static bootstrap zones
+ */
+#define STARTUP_LAUNCHES 500
+#define STARTUP_CHILD "startup_child"
+#define STARTUP_ALLOCS 200
+
+static int startup_child(void)
+{
+    void    *ptrs[STARTUP_ALLOCS];
+    int     i;
+
+    for (i = 0; i < STARTUP_ALLOCS; i++)
+    {
+        ptrs[i] = malloc(16 + (i * 53) % 700);
+        ((volatile char *)ptrs[i])[0] = 1;
+    }
+    for (i = 0; i < STARTUP_ALLOCS; i++)
+        free(ptrs[i]);
+    return 0;
+}
+
+static double startup_run(const char *bootstrap)
+{
+    double  start;
+    pid_t   pid;
+    int     i;
+
+    start = now_seconds();
+    for (i = 0; i < STARTUP_LAUNCHES; i++)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            setenv("FT_MALLOC_BOOTSTRAP", bootstrap, 1);
+            execl("/proc/self/exe", "bench_malloc", STARTUP_CHILD, (char *)NULL);
+            _exit(1);
+        }
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+    }
+    return ((now_seconds() - start) / STARTUP_LAUNCHES * 1e6);
+}
+
+static void bench_startup(void)
+{
+    double  without;
+
+    fflush(stdout);
+    without = startup_run("0");
+    printf("startup: launches=%d per_launch_no_bootstrap=%.0fus per_launch_bootstrap=%.0fus\n",
+        STARTUP_LAUNCHES, without, startup_run("1"));
+}
+
+
+typedef struct s_bench {
+    const char  *name;
+    void        (*run)(void);
+} t_bench;
+
+static const t_bench g_benches[] = {
+    {"false_sharing", bench_false_sharing},
+    {"realloc_growth", bench_realloc_growth},
+    {"rt_latency", bench_rt_latency},
+    {"calloc_bulk", bench_calloc_bulk},
+    {"pool_churn", bench_pool_churn},
+    {"lifetime_replay", bench_lifetime_replay},
+    {"single_thread", bench_single_thread},
+    {"startup", bench_startup},
+};
+
+
+int main(int argc, char **argv)
+{
+    size_t  i;
+
+    if (argc == 2 && strcmp(argv[1], STARTUP_CHILD) == 0)
+        return (startup_child());
+    for (i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++)
+    {
+        if (argc < 2 || strcmp(argv[1], g_benches[i].name) == 0)
+            g_benches[i].run();
+    }
+    return 0;
+}
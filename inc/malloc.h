@@ -21,45 +21,103 @@
 # include <stdbool.h>
 # include <stdint.h>
 # include <stdio.h>
+# include "malloc_trace.h"
 
 /*
  * Memory allocation size categories:
  * TINY: 1-128 bytes
  * SMALL: 129-1024 bytes
- * LARGE: 1025+ bytes
+ * MEDIUM: 1025 bytes up to MEDIUM_MAX (64 KB unless built with
+ *         MEDIUM_MAX=<bytes>), served as page runs from shared chunks
+ * LARGE: anything bigger, one mapping each
  */
 # define TINY_MAX 128
 # define SMALL_MAX 1024
+# ifndef MEDIUM_MAX
+#  define MEDIUM_MAX (64 * 1024)
+# endif
 
 /*
  * Zone sizes (in bytes)
  * TINY ZONE: 4 pages, approximately 16 KB
  * SMALL_ZONE: 32 pages, approximately 128 KB
+ * MEDIUM_ZONE: four times MEDIUM_MAX, 256 KB by default
  * LARGE_ZONE: sized to fit the allocation + metadata
  */
 
 # define TINY_ZONE (getpagesize() * 4)
 # define SMALL_ZONE (getpagesize() * 32)
+# define MEDIUM_ZONE (ROUND_UP(MEDIUM_MAX * 4, (size_t)getpagesize()))
+
+/*
+ * bootstrap zones: one TINY and one SMALL zone in .bss, linked into the
+ * global state when it is initialized, so the first allocations of a
+ * process (libc's own included) need no mmap. they are purged like any
+ * zone but never unmapped. only used when the page size is at most
+ * BOOTSTRAP_ALIGN; FT_MALLOC_BOOTSTRAP=0 leaves them out
+ */
+# define BOOTSTRAP_ALIGN 4096
+# define BOOTSTRAP_TINY_SIZE (4 * BOOTSTRAP_ALIGN)
+# define BOOTSTRAP_SMALL_SIZE (32 * BOOTSTRAP_ALIGN)
+
+/*
+ * free MEDIUM runs are kept in per-state bins by page count: bin n-1 holds
+ * runs of n whole pages, the last bin everything from MEDIUM_BINS pages up
+ */
+# define MEDIUM_BINS 32
+
+/*
+ * MEDIUM chunk map: the chunk (and its state) of every MEDIUM_MAP_GRANULE
+ * of chunk memory, two levels over MEDIUM_MAP_ADDR_BITS of address space,
+ * so free finds the chunk of a pointer without walking the zone lists
+ */
+# define MEDIUM_MAP_SHIFT 12
+# define MEDIUM_MAP_GRANULE (1UL << MEDIUM_MAP_SHIFT)
+# define MEDIUM_MAP_ADDR_BITS 48
+# define MEDIUM_MAP_LEAF_BITS 18
+
+/*
+ * free TINY/SMALL blocks spanning at least this many whole interior pages
+ * have those pages released (MADV_DONTNEED) when they are freed;
+ * malloc_purge() releases every whole free page regardless
+ */
+# define PURGE_MIN_PAGES 8
 
 /*
  * Alignment for memory allocations (16 bytes for SSE operations)
  */
 # define ALIGNMENT 16
 # define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+# define ROUND_UP(size, to) (((size) + ((to) - 1)) & ~((size_t)(to) - 1))
+
+/*
+ * Cache line size, used to keep hot shared fields apart.
+ * Building with -DMALLOC_CACHELINE_ALIGN rounds every block to a whole
+ * number of cache lines so that objects owned by different threads never
+ * share a line (at the cost of more internal fragmentation for TINY).
+ */
+# define CACHE_LINE 64
+# ifdef MALLOC_CACHELINE_ALIGN
+#  define BLOCK_GRAIN CACHE_LINE
+# else
+#  define BLOCK_GRAIN ALIGNMENT
+# endif
 
 // Zone types
 typedef enum e_zone_type {
     TINY = 0,
     SMALL = 1,
-    LARGE = 2
+    MEDIUM = 2,
+    LARGE = 3
 } t_zone_type;
 
 
-//Block header - precedes each memory block
+//Block header - precedes each memory block (16 bytes: size and flags share a word)
 typedef struct s_block {
-    size_t size;    // size includes the header and footer
-    unsigned int is_free:1; // status flag
-    struct s_block *next; // next block in free list (only maintained for free blocks)
+    size_t size:61;         // size includes the header and footer
+    size_t is_free:1;       // status flag
+    size_t grow_hint:2;     // saturating count of realloc growths
+    struct s_block *next;   // next free run of a MEDIUM bin (the previous one is in the payload)
 } t_block;
 
 
@@ -67,25 +125,116 @@ typedef struct s_block {
 typedef size_t t_footer;
 
 
-// zone header - managing a memory zone
+// zone header - managing a memory zone (fields read on every walk come first)
 typedef struct s_zone {
     size_t zone_size;       // total size of zone
-    t_zone_type zone_type;  // zone type: TINY,SMALL, or Large
-    size_t free_blocks;     // count of free blocks
     struct s_zone *next;    // next zone of same type
     t_block *first;         // first block in zone
+    size_t free_blocks;     // count of free blocks
+    uint64_t decommitted;   // TINY/SMALL: bit per page released with MADV_DONTNEED
+    size_t dirty;           // bytes from the zone start that may have been written
+    t_zone_type zone_type;  // zone type: TINY, SMALL, MEDIUM or LARGE
+    uint32_t lifetime;      // TINY/SMALL: lifetime class served, see malloc_hinted
 } t_zone;
 
 
-// global state
+/*
+ * allocator lock. while the process has a single thread (glibc's
+ * __libc_single_threaded) locking is skipped; only that thread can create
+ * the second one, and it never does so holding an allocator lock, so no
+ * lock is ever held elided once others exist. -DMALLOC_SINGLE_THREADED
+ * (make SINGLE_THREADED=1) compiles locking out altogether, for programs
+ * that never create threads; the background thread is then unavailable,
+ * and mapping a zone once glibc reports a second thread aborts.
+ * a contended lock parks its waiter at once; with -DMALLOC_ADAPTIVE_SPIN
+ * (make ADAPTIVE_SPIN=1) it is first retried for an adaptive number of
+ * spins (spin, kept between LOCK_SPIN_MIN and LOCK_SPIN_MAX or
+ * FT_MALLOC_LOCK_SPIN=<tries>), which only pays off when the holder runs
+ * on another core. building with -DMALLOC_LOCK_STATS (make
+ * LOCKSTATS=1) records, per lock, how often it was contended and how long
+ * waiters waited, with a log2 histogram of wait times in nanoseconds
+ */
+# define LOCK_STAT_BUCKETS 32
+# define LOCK_SPIN_MIN 4
+# define LOCK_SPIN_START 32
+# define LOCK_SPIN_MAX 100
+
+typedef struct s_lock_stats {
+    uint64_t acquisitions;  // total lock acquisitions
+    uint64_t contended;     // acquisitions that had to wait
+    uint64_t total_wait_ns; // sum of waits
+    uint64_t max_wait_ns;   // longest wait
+    uint64_t spin_acquired; // contended acquisitions won while spinning
+    uint64_t buckets[LOCK_STAT_BUCKETS];  // waits by floor(log2(ns))
+} t_lock_stats;
+
+typedef struct s_lock {
+    pthread_mutex_t mutex;
+    int elided;             // taken while single threaded, the mutex was not
+# ifdef MALLOC_ADAPTIVE_SPIN
+    int spin;               // trylocks before parking, adapted under the lock
+# endif
+# ifdef MALLOC_LOCK_STATS
+    t_lock_stats stats;     // only updated while the lock is held
+# endif
+} t_lock;
+
+# ifdef MALLOC_ADAPTIVE_SPIN
+#  define LOCK_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, 0, LOCK_SPIN_START}
+# else
+#  define LOCK_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, 0}
+# endif
+
+
+/*
+ * LARGE zone registry - an open-addressed table of zone pointers updated
+ * with CAS only, so LARGE mmap/munmap never run under the state mutex.
+ * slots is mapped on first use; a zone only ever lives within
+ * LARGE_REGISTRY_PROBES slots of its home, when those are taken it falls
+ * back to the locked large_zones list. walkers counts threads reading zone
+ * headers from the table (they hold the mutex), so free knows when to wait.
+ */
+# define LARGE_REGISTRY_SLOTS 8192
+# define LARGE_REGISTRY_PROBES 16
+# define LARGE_SLOT_TOMBSTONE ((t_zone *)1)
+
+typedef struct s_large_registry {
+    t_zone  **slots;        // LARGE_REGISTRY_SLOTS entries, NULL = never used
+    int     walkers;        // threads walking the table
+} t_large_registry;
+
+
+/*
+ * global state - the lock gets a cache line of its own so that lock
+ * traffic does not keep invalidating the list heads on other cores
+ */
 typedef struct s_malloc_state {
-    t_zone *tiny_zones;     // list of TINY zones
+    t_lock lock __attribute__((aligned(CACHE_LINE)));   // for thread safety
+    t_zone *tiny_zones __attribute__((aligned(CACHE_LINE)));     // list of TINY zones
     t_zone *small_zones;    // list of SMALL zones
-    t_zone *large_zones;    // list of LARGE zones
-    pthread_mutex_t mutex;  // for thread safety
+    t_zone *medium_zones;   // list of MEDIUM chunks
+    t_block *medium_bins[MEDIUM_BINS];  // free MEDIUM runs by page count
+    t_zone *large_zones;    // LARGE zones that did not fit in the registry
+    t_large_registry large __attribute__((aligned(CACHE_LINE)));  // lock-free LARGE zones
+    t_zone *reserve[2];     // pre-faulted spare TINY/SMALL zones (malloc_reserve)
+    size_t reserve_count[2];
+    t_zone *large_cache;    // pre-faulted LARGE zones for reserve-only threads
+    size_t reserved_large;  // LARGE zones malloc_reserve asked to keep cached
+    int reserved;           // malloc_reserve was used: keep pages resident
+    t_zone *ready[2];       // TINY/SMALL zones pre-faulted by the background thread
+    size_t ready_count[2];
+    int node;               // NUMA node new zones are bound to, -1 = unbound
+    struct s_malloc_state *next;    // next registered heap (heaps only)
 } t_malloc_state;
 
 
+/*
+ * user-created heap (arena): owns its own zone lists and lock, so all of
+ * its allocations can be released at once by heap_destroy()
+ */
+typedef t_malloc_state t_heap;
+
+
 // calculate footer position from a block header
 # define FOOTER(block) ((t_footer *)((char *)(block)+(block)->size - sizeof(t_footer)))
 
@@ -97,23 +246,421 @@ typedef struct s_malloc_state {
 # define PTR_FROM_BLOCK(block) ((void *)((char *)(block) + sizeof(t_block)))
 
 // calculate size of block including all metadata
-# define BLOCK_SIZE(size) (ALIGN(sizeof(t_block) + (size) + sizeof(t_footer)))
+# define BLOCK_SIZE(size) (ROUND_UP(sizeof(t_block) + (size) + sizeof(t_footer), BLOCK_GRAIN))
+
+// largest request served: its block and zone sizes neither wrap nor overflow the 61-bit size field
+# define MAX_ALLOC_SIZE (SIZE_MAX >> 4)
+
+// offset of the first block in a zone, chosen so user data starts on a BLOCK_GRAIN boundary
+# define ZONE_HEADER_SIZE (ROUND_UP(sizeof(t_zone) + sizeof(t_block), BLOCK_GRAIN) - sizeof(t_block))
+
+// first block of a zone, computed rather than read so block walks also work on a zone mapped elsewhere
+# define ZONE_FIRST(zone) ((t_block *)((char *)(zone) + ZONE_HEADER_SIZE))
+
+/*
+ * realloc growth detection: once a block has been grown GROW_HINT_THRESHOLD
+ * times, the next move reserves geometric headroom (double the block, but
+ * never more than GROW_RESERVE_MAX extra bytes)
+ */
+# define GROW_HINT_MAX 3
+# define GROW_HINT_THRESHOLD 2
+# define GROW_RESERVE_MAX (16UL * 1024 * 1024)
+
+/*
+ * fixed-size object pools (pool.c): objects of one size carved from zones
+ * of their own, with no per-object header; freed objects go on a LIFO list
+ * linked through their first word. a pool created with POOL_MAGAZINES also
+ * lets each thread keep up to POOL_MAGAZINE_SIZE of its objects to itself
+ */
+# define POOL_MAGAZINES 1
+# define POOL_MAGAZINE_SIZE 16
+# define POOL_MAGAZINE_SLOTS 8      // pools a thread keeps a magazine for
+# define POOL_ZONE_MIN (64 * 1024)
+# define POOL_ZONE_OBJECTS 64       // objects every pool zone holds at least
+
+typedef struct s_pool_zone {
+    size_t zone_size;           // total size of the mapping
+    struct s_pool_zone *next;   // next zone of the pool
+    char *first;                // first object
+    char *bump;                 // first object never handed out
+    char *end;                  // end of the last whole object
+} t_pool_zone;
+
+typedef struct s_pool {
+    t_lock lock __attribute__((aligned(CACHE_LINE)));   // guards the pool
+    void *free_list;        // freed objects, most recent first
+    t_pool_zone *zones;     // newest first, only the first one has room left
+    size_t obj_size;        // object size rounded up to align
+    size_t align;
+    int flags;              // POOL_MAGAZINES
+    int node;               // NUMA node the zones are bound to, -1 = any
+    uint64_t id;            // never reused, tells a dead pool from a new one
+    size_t zone_count;
+    size_t mapped_bytes;
+    size_t in_use;          // objects out of the shared list, magazines included
+    size_t refills;         // magazine refills from the shared list
+    size_t flushes;         // magazine flushes to the shared list
+    struct s_pool *next;    // next registered pool
+} t_pool;
+
+typedef struct s_pool_stats {
+    size_t obj_size;
+    size_t zones;
+    size_t mapped_bytes;
+    size_t capacity;            // objects the zones can hold
+    size_t in_use;              // handed out, or held in a thread's magazine
+    size_t magazine_refills;
+    size_t magazine_flushes;
+} t_pool_stats;
+
+/*
+ * shared-memory heap (shm.c): one zone inside a memfd or shm_open region
+ * that several processes map at different addresses. the region stores no
+ * pointers: objects are named by their offset from the region start, and
+ * the header locates the zone the same way. a process-shared robust mutex
+ * guards it; a heap left inconsistent by a dead holder is marked broken
+ */
+# define SHM_MAGIC 0x636f6c6c616d7466ULL    // "ftmalloc"
+# define SHM_MIN_SIZE (64 * 1024)
+
+typedef uint64_t t_shm_off;     // offset from the region start, 0 = none
+
+typedef struct s_shm_header {
+    uint64_t magic;
+    uint64_t size;              // whole region
+    t_shm_off zone;             // the zone, cache line aligned
+    t_shm_off root;             // object published with shm_set_root
+    uint32_t broken;            // a dead holder left the blocks inconsistent
+    pthread_mutex_t mutex;      // process-shared, robust
+} t_shm_header;
+
+typedef struct s_shm_heap {     // per-process handle, never shared
+    t_shm_header *base;         // where this process mapped the region
+    size_t size;
+    int fd;
+} t_shm_heap;
+
+/*
+ * heap analysis report (malloc_analyze). byte counts are user-visible
+ * bytes for live/free, metadata for overhead
+ */
+# define ANALYZE_FREE_BUCKETS 24
+# define ANALYZE_NEARLY_EMPTY_PCT 10
+
+typedef struct s_zone_report {
+    void        *zone;
+    t_zone_type zone_type;
+    size_t      zone_size;
+    size_t      live_bytes;
+    size_t      largest_free;   // largest free block of this zone
+    int         nearly_empty;   // live data under ANALYZE_NEARLY_EMPTY_PCT percent
+    int         bootstrap;      // static bootstrap zone, kept even when empty
+} t_zone_report;
+
+typedef struct s_heap_report {
+    size_t  zones[4];           // zone count per t_zone_type
+    size_t  mapped_bytes;       // total zone sizes
+    size_t  decommitted_bytes;  // interior pages released by purging
+    size_t  live_bytes;         // bytes handed out to the program
+    size_t  overhead_bytes;     // zone headers, block headers/footers, LARGE slack
+    size_t  free_bytes;         // free but still mapped
+    size_t  zone_free_bytes;    // the TINY/SMALL share of free_bytes
+    size_t  live_blocks;
+    size_t  free_blocks;
+    size_t  free_by_bucket[ANALYZE_FREE_BUCKETS];  // free blocks by floor(log2(bytes))
+    size_t  largest_free;       // largest free TINY/SMALL block
+    size_t  nearly_empty_zones;
+    double  external_fragmentation; // 1 - largest_free / zone_free_bytes
+    size_t  spare_bytes;        // zones not serving yet: malloc_reserve, ready, LARGE cache
+    size_t  reclaimable_bytes;  // empty zones and spare zones malloc_reserve does not keep
+    size_t  pool_bytes;         // mapped by object pools (global analysis only)
+    size_t  pool_live_bytes;    // pool objects handed out
+    size_t  pool_magazine_bytes;    // pool objects parked in thread magazines
+} t_heap_report;
+
+/*
+ * bounded-latency mode: malloc_reserve() pre-faults zones ahead of time and
+ * a thread with MALLOC_POLICY_RESERVE_ONLY is served from them only; it
+ * never enters the kernel from malloc/free and gets NULL once they run out
+ */
+# define MALLOC_RESERVE_MLOCK 1         // lock reserved zones into RAM
+# define MALLOC_POLICY_DEFAULT 0
+# define MALLOC_POLICY_RESERVE_ONLY 1
+
+/*
+ * NUMA placement (numa.c): one arena per memory node, zones bound to the
+ * arena's node. nodes is 1 when NUMA is off or there is a single node.
+ * with several, an owner map holds the node of every OWNER_GRANULE of
+ * zone memory (two levels over OWNER_ADDR_BITS of address space) so free
+ * finds the arena of a pointer without a lock
+ */
+# define NUMA_MAX_NODES 16
+# define OWNER_SHIFT 12
+# define OWNER_GRANULE (1UL << OWNER_SHIFT)
+# define OWNER_ADDR_BITS 48
+# define OWNER_LEAF_BITS 20
+
+/*
+ * background maintenance thread (background.c), off unless enabled with
+ * malloc_background(1) or FT_MALLOC_BACKGROUND=1 (=0 forbids it): keeps
+ * BACKGROUND_READY_ZONES pre-faulted TINY and SMALL zones ready per arena,
+ * and every BACKGROUND_PURGE_MS purges free pages and trims the LARGE cache
+ */
+# define BACKGROUND_READY_ZONES 2
+# define BACKGROUND_TICK_MS 100
+# define BACKGROUND_PURGE_MS 1000
+# define BACKGROUND_STACK (256 * 1024)
+
+typedef struct s_background_stats {
+    int     enabled;
+    int     running;            // thread currently alive
+    size_t  zones_prepared;     // zones mapped and pre-faulted so far
+    size_t  zones_ready;        // ready zones waiting in the arenas
+    size_t  purged_bytes;       // released by the periodic purge
+    size_t  large_trimmed;      // cached LARGE zones unmapped
+} t_background_stats;
+
+/*
+ * memory pressure (pressure.c): cgroup v2 memory.current / memory.max and
+ * /proc/pressure/memory, read at most every PRESSURE_INTERVAL_MS. headroom
+ * under PRESSURE_HIGH_PCT percent of the limit, or a PSI "some avg10" of at
+ * least PRESSURE_PSI_HIGH, makes the allocator hand back everything it
+ * retains; over PRESSURE_LOW_PCT with PSI under PRESSURE_PSI_LOW it keeps
+ * more. PSI values are in hundredths of a percent
+ */
+# define MALLOC_PRESSURE_LOW 0
+# define MALLOC_PRESSURE_NORMAL 1
+# define MALLOC_PRESSURE_HIGH 2
+# define PRESSURE_INTERVAL_MS 250
+# define PRESSURE_HIGH_PCT 5
+# define PRESSURE_LOW_PCT 25
+# define PRESSURE_PSI_HIGH 1000
+# define PRESSURE_PSI_LOW 100
+# define PRESSURE_PATH_MAX 256
+
+typedef struct s_pressure_stats {
+    int     level;          // MALLOC_PRESSURE_LOW / NORMAL / HIGH
+    size_t  current;        // memory.current, 0 if unknown
+    size_t  limit;          // memory.max, 0 if unknown or "max"
+    int     psi_some_avg10; // -1 if unknown
+    size_t  polls;          // times the files were read
+    size_t  shrinks;        // times retained memory was handed back
+    size_t  released_bytes; // by those shrinks
+} t_pressure_stats;
+
+/*
+ * lifetime hints (lifetime.c): each TINY/SMALL zone serves one lifetime
+ * class, so short-lived blocks never share a zone with a long-lived one
+ * that would keep it mapped. unhinted blocks form a class of their own and
+ * an empty zone is taken over by whichever class needs one. with
+ * FT_MALLOC_LIFETIME=1 (or malloc_lifetime_predict) malloc samples one
+ * allocation in LIFETIME_SAMPLE_RATE, keyed by call site, and hints a
+ * call site once its samples agree: freed within LIFETIME_SHORT_AGE
+ * samples is short, surviving longer is long. a call site is the return
+ * address of malloc, so every block allocated through a wrapper (xmalloc,
+ * a container's allocate) shares the wrapper's one site; make
+ * LIFETIME_FRAMES=1 builds with frame pointers and hashes
+ * LIFETIME_SITE_FRAMES return addresses instead, which only sees past the
+ * wrapper if the program is built with -fno-omit-frame-pointer too.
+ * realloc keeps the class of the block it moves
+ */
+# define MALLOC_HINT_SHORT_LIVED 1
+# define MALLOC_HINT_LONG_LIVED 2
+# define LIFETIME_DEFAULT 0
+# define LIFETIME_SHORT 1
+# define LIFETIME_LONG 2
+# define LIFETIME_SAMPLE_RATE 32        // allocations per sample, power of 2
+# define LIFETIME_SAMPLES 256           // samples tracked at once, power of 2
+# define LIFETIME_SITES 1024            // call sites tracked, power of 2
+# define LIFETIME_SHORT_AGE 64          // samples taken while one is live
+# define LIFETIME_MIN_VOTES 8           // before a site is predicted
+# define LIFETIME_MAJORITY 4            // one kind must outvote the other this often
+# define LIFETIME_MAX_VOTES 256         // votes are halved past this
+# define LIFETIME_SITE_FRAMES 3         // return addresses per call site, LIFETIME_FRAMES=1
+# define LIFETIME_FRAME_SPAN 65536      // furthest a saved frame pointer is followed
+
+typedef struct s_lifetime_stats {
+    int     predicting;
+    size_t  sites;          // call sites seen by the sampler
+    size_t  sites_short;    // of those, currently predicted short-lived
+    size_t  sites_long;     // ... and long-lived
+    size_t  samples;
+    size_t  zones[3];       // TINY/SMALL zones per lifetime class
+} t_lifetime_stats;
+
+typedef struct s_numa_stats {
+    int     nodes;                          // arenas in use
+    size_t  zones_bound[NUMA_MAX_NODES];    // zones mbind'ed to the node
+    size_t  bind_failed[NUMA_MAX_NODES];    // zones the kernel refused to bind
+    size_t  zones_local[NUMA_MAX_NODES];    // arena zones currently on their node
+    size_t  zones_remote[NUMA_MAX_NODES];   // arena zones that ended up elsewhere
+} t_numa_stats;
 
 // function declarations
 void    *malloc(size_t size);
 void    free(void *ptr);
 void    *realloc(void *ptr, size_t size);
+void    *calloc(size_t nmemb, size_t size);
 void    show_alloc_mem(void);
+size_t  malloc_usable_size(void *ptr);
+void    realloc_trim(void *ptr, size_t size);
+size_t  malloc_purge(void);
+int     malloc_analyze(t_heap *heap, t_heap_report *report,
+            void (*per_zone)(const t_zone_report *));
+void    show_alloc_analysis(t_heap *heap);
+int     malloc_trace_enable(int on);
+int     malloc_lock_stats(t_heap *heap, t_lock_stats *stats);
+int     malloc_single_threaded(void);
+void    show_malloc_stats(void);
+int     malloc_reserve(size_t tiny_zones, size_t small_zones,
+            size_t large_size, size_t large_count, int flags);
+int     malloc_set_thread_policy(int policy);
+int     malloc_numa_bind_thread(int node);
+int     malloc_numa_stats(t_numa_stats *stats);
+int     malloc_background(int on);
+int     malloc_background_stats(t_background_stats *stats);
+int     malloc_pressure_config(const char *cgroup_dir, const char *psi_path);
+int     malloc_pressure_stats(t_pressure_stats *stats);
+void    *malloc_hinted(size_t size, int hints);
+int     malloc_lifetime_predict(int on);
+int     malloc_lifetime_stats(t_lifetime_stats *stats);
+
+/* fixed-size object pools */
+t_pool  *pool_create(size_t obj_size, size_t align);
+t_pool  *pool_create_flags(size_t obj_size, size_t align, int flags);
+void    *pool_alloc(t_pool *pool);
+void    pool_free(t_pool *pool, void *ptr);
+void    pool_destroy(t_pool *pool);
+int     pool_stats(t_pool *pool, t_pool_stats *stats);
+
+/* shared-memory heap, addressed by offset */
+t_shm_heap  *shm_heap_create(const char *name, size_t size);
+t_shm_heap  *shm_heap_open(const char *name);
+t_shm_heap  *shm_heap_attach(int fd);
+int         shm_heap_fd(t_shm_heap *heap);
+void        shm_heap_close(t_shm_heap *heap);
+t_shm_off   shm_malloc(t_shm_heap *heap, size_t size);
+void        shm_free(t_shm_heap *heap, t_shm_off offset);
+void        *shm_ptr(t_shm_heap *heap, t_shm_off offset);
+t_shm_off   shm_offset(t_shm_heap *heap, void *ptr);
+int         shm_set_root(t_shm_heap *heap, t_shm_off offset);
+t_shm_off   shm_get_root(t_shm_heap *heap);
+
+/* region-scoped heaps */
+t_heap  *heap_create(void);
+void    *heap_malloc(t_heap *heap, size_t size);
+void    heap_free(t_heap *heap, void *ptr);
+void    heap_destroy(t_heap *heap);
 
 /* internal helper functions */
 size_t get_user_size(t_block *block);
-t_zone  *create_zone(t_zone_type zone_type, size_t size);
-t_zone  *find_zone_with_space(size_t size, t_zone_type zone_type);
+size_t  zone_size_for(t_zone_type zone_type, size_t size);
+void    init_zone(t_zone *zone, t_zone_type zone_type, size_t zone_size);
+void    bootstrap_zones(t_malloc_state *state);
+bool    zone_is_bootstrap(t_zone *zone);
+t_zone  *map_zone(t_zone_type zone_type, size_t size, int node);
+t_zone  *create_zone(t_malloc_state *state, t_zone_type zone_type, size_t size);
+t_zone  *find_zone_with_space(t_malloc_state *state, size_t size, t_zone_type zone_type,
+            uint32_t lifetime);
 t_block *find_free_block(t_zone *zone, size_t size);
-t_block *split_block(t_block *block, size_t size);
-void    merge_free_blocks(t_zone *zone, t_block *block);
-void    *allocate_large(size_t size);
-bool    try_extend_block(t_block *block, size_t new_size);
+t_block *split_block(t_zone *zone, t_block *block, size_t size);
+t_block *merge_free_blocks(t_zone *zone, t_block *block);
+t_block *next_in_zone(t_zone *zone, t_block *block);
+t_block *prev_in_zone(t_zone *zone, t_block *block);
+size_t  medium_run_size(size_t size);
+void    *medium_alloc(t_malloc_state *state, size_t size, bool zero, unsigned int hint);
+t_block *medium_free(t_malloc_state *state, t_zone *zone, t_block *block);
+void    medium_unbin(t_malloc_state *state, t_block *block);
+void    medium_resize_begin(t_malloc_state *state, t_zone *zone, t_block *block);
+void    medium_resize_end(t_malloc_state *state, t_zone *zone, t_block *block);
+t_zone  *medium_find(t_malloc_state *state, void *ptr, t_block **block_ptr);
+void    medium_forget(t_zone *zone);
+t_zone  *find_zone_for_ptr(t_malloc_state *state, void *ptr, t_block **block_ptr);
+void    *allocate_large(t_malloc_state *state, size_t size, unsigned int hint);
+bool    large_register(t_malloc_state *state, t_zone *zone);
+bool    large_release(t_malloc_state *state, void *ptr);
+t_zone  *large_find(t_malloc_state *state, void *ptr);
+t_zone  *large_next(t_malloc_state *state, size_t *cursor);
+void    large_walk_begin(t_malloc_state *state);
+void    large_walk_end(t_malloc_state *state);
+void    large_destroy(t_malloc_state *state);
+void    malloc_init(void);
+int     lock_init(t_lock *lock);
+void    lock_destroy(t_lock *lock);
+void    zone_commit_block(t_zone *zone, t_block *block);
+void    zone_zero_block(t_zone *zone, t_block *block);
+size_t  zone_purge_block(t_zone *zone, t_block *block, size_t min_pages);
+size_t  state_purge(t_malloc_state *state);
+void    malloc_lock(t_lock *lock);
+void    malloc_unlock(t_lock *lock);
+# ifdef MALLOC_SINGLE_THREADED
+void    lock_check_threads(void);
+# else
+#  define lock_check_threads() ((void)0)
+# endif
+void    trace_init(void);
+bool    thread_reserve_only(void);
+void    numa_init(void);
+void    numa_resolve(void);
+void    numa_bind(void *addr, size_t size, int node);
+bool    numa_mark(void *addr, size_t size, int node);
+t_malloc_state *numa_arena(void);
+t_malloc_state *numa_arena_at(int node);
+t_malloc_state *numa_owner(void *ptr);
+t_zone  *reserve_take_zone(t_malloc_state *state, t_zone_type zone_type);
+void    reserve_put_zone(t_malloc_state *state, t_zone *zone);
+t_zone  *large_cache_take(t_malloc_state *state, size_t size);
+void    large_cache_put(t_malloc_state *state, t_zone *zone);
+int     prefault_zone(t_zone *zone, int flags);
+void    background_init(void);
+void    background_wake(void);
+void    background_spawn(void);
+bool    background_running(void);
+void    background_atfork_child(void);
+t_zone  *ready_take_zone(t_malloc_state *state, t_zone_type zone_type);
+bool    ready_put_zone(t_malloc_state *state, t_zone *zone);
+void    ready_release(t_malloc_state *state);
+size_t  large_cache_trim(t_malloc_state *state);
+size_t  state_release_empty(t_malloc_state *state);
+void    pressure_init(void);
+void    pressure_note_mapping(void);
+void    pressure_check(void);
+void    pressure_poll(void);
+int     pressure_level(void);
+size_t  pressure_purge_pages(void);
+void    pressure_atfork_child(void);
+void    lifetime_init(void);
+bool    lifetime_predicting(void);
+uint32_t lifetime_predict(void *site);
+void    lifetime_sample(void *ptr, void *site);
+void    lifetime_forget(void *ptr);
+void    trace_atfork_child(void);
+void    *state_malloc(t_malloc_state *state, size_t size);
+void    *state_calloc(t_malloc_state *state, size_t size);
+void    *state_malloc_lifetime(t_malloc_state *state, size_t size, uint32_t lifetime,
+            unsigned int hint);
+void    state_free(t_malloc_state *state, void *ptr);
+t_block *try_extend_block(t_zone *zone, t_block *block, size_t new_size);
 size_t    print_zone(t_zone *zone, t_zone_type zone_type);
+size_t  show_pools(void);
+void    pool_analyze(size_t *mapped, size_t *live, size_t *parked);
+
+/* fork safety */
+void    pool_lock_all(void);
+void    pool_unlock_all(void);
+void    pool_reset_locks(void);
+void    heap_lock_all(void);
+void    heap_unlock_all(void);
+void    heap_reset_locks(void);
+void    malloc_atfork_prepare(void);
+void    malloc_atfork_parent(void);
+void    malloc_atfork_child(void);
+
+/* shared helpers (utils.c) */
+void    ft_memcpy(void *dst, const void *src, size_t size);
+void    ft_memmove_down(void *dst, const void *src, size_t size);
+void    ft_bzero(void *dst, size_t size);
+size_t  append_str(char *buf, size_t len, size_t cap, const char *str);
+uint64_t now_ms(void);
 
 #endif 
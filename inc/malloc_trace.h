@@ -0,0 +1,91 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   malloc_trace.h                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph <student@42.fr>                    +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05                                 #+#    #+#             */
+/*   Updated: 2025-05                                ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+
+#ifndef MALLOC_TRACE_H
+# define MALLOC_TRACE_H
+
+# include <stdint.h>
+
+/*
+ * Event tracing - shared between the library and the trace_dump tool.
+ *
+ * Each thread writes fixed-size records into its own ring, a file mapped
+ * MAP_SHARED at <dir>/ft_malloc_trace.<pid>.<tid> (dir defaults to
+ * /dev/shm, override with FT_MALLOC_TRACE_DIR) so the ring can be read from
+ * outside the process. Tracing is compiled in with -DMALLOC_TRACE
+ * (make TRACE=1) and switched on with FT_MALLOC_TRACE=1 or
+ * malloc_trace_enable(); compiled in but off, a tracepoint is one branch.
+ *
+ * A ring file is removed when its thread or the process exits, unless
+ * FT_MALLOC_TRACE_KEEP=1 keeps them for reading afterwards; trace_dump
+ * then removes a ring once its process is gone, as it does for rings left
+ * by a process that died without exiting.
+ */
+# define TRACE_MAGIC 0x46544D5452414345ULL  // "FTMTRACE"
+# define TRACE_VERSION 1
+# define TRACE_RING_RECORDS 16384
+
+// event types
+typedef enum e_trace_event {
+    TRACE_ZONE_CREATE = 1,  // mmap of a new zone, size = zone size
+    TRACE_ZONE_UNMAP = 2,   // munmap of an empty TINY/SMALL zone
+    TRACE_LARGE_ALLOC = 3,  // LARGE allocation, size = block size
+    TRACE_LARGE_FREE = 4,   // munmap of a LARGE zone
+    TRACE_LOCK_WAIT = 5     // contended lock acquisition
+} t_trace_event;
+
+
+// one trace record (32 bytes)
+typedef struct s_trace_record {
+    uint64_t tsc;           // timestamp counter at the end of the event
+    uint32_t type;          // t_trace_event
+    uint32_t tid;           // thread that wrote the record
+    uint64_t size;          // bytes involved, 0 if none
+    uint64_t duration;      // timestamp counter ticks spent in the event
+} t_trace_record;
+
+
+// ring header, followed by TRACE_RING_RECORDS records
+typedef struct s_trace_ring {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t capacity;      // number of records
+    uint64_t head;          // total records ever written, slot = head % capacity
+    uint32_t pid;           // writer, so readers can tell a dead ring
+    uint32_t tid;
+    uint64_t pad[4];
+    t_trace_record records[];
+} t_trace_ring;
+
+# define TRACE_RING_BYTES (sizeof(t_trace_ring) + TRACE_RING_RECORDS * sizeof(t_trace_record))
+
+
+# ifdef MALLOC_TRACE
+
+extern int g_trace_enabled;
+
+uint64_t    trace_clock(void);
+void        trace_record(t_trace_event type, uint64_t size, uint64_t start);
+
+#  define TRACE_START(var) uint64_t var = (__builtin_expect(g_trace_enabled, 0) ? trace_clock() : 0)
+#  define TRACE_END(type, size, var) \
+    do { if (__builtin_expect(g_trace_enabled, 0)) trace_record((type), (size), (var)); } while (0)
+
+# else
+
+#  define TRACE_START(var)
+#  define TRACE_END(type, size, var) do { } while (0)
+
+# endif
+
+#endif
@@ -0,0 +1,435 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   analyze.c                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/*
+ * Heap fragmentation / utilization analysis.
+ *
+ * Zone and block metadata is copied into a private snapshot, an mmap'd
+ * array so the analyzer never calls malloc. A first pass under each lock
+ * only counts the entries; the array is mapped with no lock held, and a
+ * second pass copies into it, starting over with a bigger array if the
+ * heap grew past it in between. All the arithmetic runs on the snapshot
+ * afterwards. The global analysis covers every NUMA arena and the object
+ * pools; spare zones (malloc_reserve, background ready zones, the LARGE
+ * cache) are counted but their blocks are not walked.
+ */
+
+#define SNAP_ZONE 0
+#define SNAP_USED 1
+#define SNAP_FREE 2
+#define SNAP_SPARE 3        // spare zone, returnable
+#define SNAP_RESERVED 4     // spare zone kept for malloc_reserve
+
+#define SNAP_IS_BLOCK(kind) ((kind) == SNAP_USED || (kind) == SNAP_FREE)
+
+typedef struct s_snap_entry {
+    uintptr_t   addr;       // zone or block address
+    size_t      size;       // zone or block size
+    uint64_t    decommitted;    // zone entries: page bitmap
+    uint32_t    kind;       // SNAP_ZONE / SNAP_USED / SNAP_FREE
+    uint32_t    zone_type;  // zone entries: t_zone_type
+} t_snap_entry;
+
+typedef struct s_snapshot {
+    t_snap_entry    *entries;
+    size_t          count;
+    size_t          capacity;
+    bool            failed;
+} t_snapshot;
+
+
+/*
+ * record one entry if there is room; the count goes on regardless, so a
+ * pass over a full (or absent) array tells how big it has to be
+ */
+static void snap_push(t_snapshot *snap, t_snap_entry entry)
+{
+    if (snap->count < snap->capacity)
+        snap->entries[snap->count] = entry;
+    snap->count++;
+}
+
+
+/* copy a zone and all of its blocks */
+static void snap_zone(t_snapshot *snap, t_zone *zone)
+{
+    t_block         *block;
+    t_snap_entry    entry;
+
+    entry.addr = (uintptr_t)zone;
+    entry.size = zone->zone_size;
+    entry.decommitted = zone->decommitted;
+    entry.kind = SNAP_ZONE;
+    entry.zone_type = zone->zone_type;
+    snap_push(snap, entry);
+
+    block = zone->first;
+    while (block)
+    {
+        entry.addr = (uintptr_t)block;
+        entry.size = block->size;
+        entry.decommitted = 0;
+        entry.kind = block->is_free ? SNAP_FREE : SNAP_USED;
+        snap_push(snap, entry);
+
+        if ((char *)block + block->size < (char *)zone + zone->zone_size)
+            block = (t_block *)((char *)block + block->size);
+        else
+            break;
+    }
+}
+
+
+/* copy a zone list */
+static void snap_zone_list(t_snapshot *snap, t_zone *zone)
+{
+    while (zone)
+    {
+        snap_zone(snap, zone);
+        zone = zone->next;
+    }
+}
+
+
+/* a zone that serves nothing yet, without its blocks */
+static void snap_spare(t_snapshot *snap, t_zone *zone, uint32_t kind)
+{
+    t_snap_entry    entry;
+
+    entry.addr = (uintptr_t)zone;
+    entry.size = zone->zone_size;
+    entry.decommitted = 0;
+    entry.kind = kind;
+    entry.zone_type = zone->zone_type;
+    snap_push(snap, entry);
+}
+
+
+/* one pass over a state, under its lock */
+static void snap_state(t_snapshot *snap, t_malloc_state *state)
+{
+    t_zone_type zone_type;
+    t_zone      *zone;
+    size_t      cursor;
+    size_t      kept;
+
+    malloc_lock(&state->lock);
+    snap_zone_list(snap, state->tiny_zones);
+    snap_zone_list(snap, state->small_zones);
+    snap_zone_list(snap, state->medium_zones);
+    snap_zone_list(snap, state->large_zones);
+
+    large_walk_begin(state);
+    cursor = 0;
+    while ((zone = large_next(state, &cursor)))
+        snap_zone(snap, zone);
+    large_walk_end(state);
+
+    for (zone_type = TINY; zone_type <= SMALL; zone_type++)
+    {
+        for (zone = state->reserve[zone_type]; zone; zone = zone->next)
+            snap_spare(snap, zone, SNAP_RESERVED);
+        for (zone = state->ready[zone_type]; zone; zone = zone->next)
+            snap_spare(snap, zone, SNAP_SPARE);
+    }
+    /* the first reserved_large cached zones are what malloc_reserve keeps */
+    kept = 0;
+    for (zone = state->large_cache; zone; zone = zone->next)
+        snap_spare(snap, zone, kept++ < state->reserved_large ? SNAP_RESERVED : SNAP_SPARE);
+    malloc_unlock(&state->lock);
+}
+
+
+/* one pass over every state; false if the array was too small */
+static bool snap_states(t_snapshot *snap, t_malloc_state **states, int count)
+{
+    int i;
+
+    snap->count = 0;
+    for (i = 0; i < count; i++)
+        snap_state(snap, states[i]);
+    return (snap->count <= snap->capacity);
+}
+
+
+/*
+ * take the snapshot: count under the locks, map the array with none held,
+ * copy, and start over if the heap outgrew the array meanwhile
+ */
+static void take_snapshot(t_snapshot *snap, t_malloc_state **states, int count)
+{
+    size_t  bytes;
+    void    *entries;
+
+    snap_states(snap, states, count);
+    while (true)
+    {
+        /* some room for what other threads add before the copy */
+        bytes = ROUND_UP((snap->count + snap->count / 8 + 64) * sizeof(t_snap_entry),
+            (size_t)getpagesize());
+        if (snap->entries)
+            munmap(snap->entries, snap->capacity * sizeof(t_snap_entry));
+        snap->capacity = 0;
+        entries = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (entries == MAP_FAILED)
+        {
+            snap->entries = NULL;
+            snap->failed = true;
+            return;
+        }
+        snap->entries = entries;
+        snap->capacity = bytes / sizeof(t_snap_entry);
+        if (snap_states(snap, states, count))
+            return;
+    }
+}
+
+
+/* number of set bits */
+static size_t count_bits(uint64_t bits)
+{
+    size_t  count;
+
+    count = 0;
+    while (bits)
+    {
+        bits &= bits - 1;
+        count++;
+    }
+    return count;
+}
+
+
+/* bucket index of a free size: floor(log2(size)) */
+static int free_bucket(size_t size)
+{
+    int bucket;
+
+    bucket = 0;
+    while (size > 1 && bucket < ANALYZE_FREE_BUCKETS - 1)
+    {
+        size >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+
+/*
+ * close the per-zone accounting of a zone entry; zone_live and
+ * zone_largest are the totals gathered over its blocks
+ */
+static void finish_zone(t_heap_report *report, t_snap_entry *zone,
+    size_t zone_live, size_t zone_largest, void (*per_zone)(const t_zone_report *))
+{
+    t_zone_report   zone_report;
+
+    zone_report.zone = (void *)zone->addr;
+    zone_report.zone_type = zone->zone_type;
+    zone_report.zone_size = zone->size;
+    zone_report.live_bytes = zone_live;
+    zone_report.largest_free = zone_largest;
+    zone_report.nearly_empty = zone->zone_type != LARGE && zone_live > 0 &&
+        zone_live * 100 <= (zone->size - ZONE_HEADER_SIZE) * ANALYZE_NEARLY_EMPTY_PCT;
+    zone_report.bootstrap = zone_is_bootstrap((t_zone *)zone->addr);
+
+    if (zone_report.nearly_empty)
+        report->nearly_empty_zones++;
+    /* an empty zone could be unmapped, unless it is a static one */
+    if (!zone_live && !zone_report.bootstrap)
+        report->reclaimable_bytes += zone->size;
+    if (per_zone)
+        per_zone(&zone_report);
+}
+
+
+/* compute the report from the snapshot, no lock held */
+static void analyze_snapshot(t_snapshot *snap, t_heap_report *report,
+    void (*per_zone)(const t_zone_report *))
+{
+    t_snap_entry    *entry;
+    t_snap_entry    *zone;
+    size_t          zone_live;
+    size_t          zone_largest;
+    size_t          used;
+    size_t          user;
+    size_t          i;
+
+    zone = NULL;
+    zone_live = 0;
+    zone_largest = 0;
+    used = 0;
+    for (i = 0; i < snap->count; i++)
+    {
+        entry = &snap->entries[i];
+        if (!SNAP_IS_BLOCK(entry->kind) && zone)
+        {
+            finish_zone(report, zone, zone_live, zone_largest, per_zone);
+            zone = NULL;
+        }
+        if (entry->kind == SNAP_SPARE || entry->kind == SNAP_RESERVED)
+        {
+            report->mapped_bytes += entry->size;
+            report->spare_bytes += entry->size;
+            if (entry->kind == SNAP_SPARE)
+                report->reclaimable_bytes += entry->size;
+            continue;
+        }
+        if (entry->kind == SNAP_ZONE)
+        {
+            zone = entry;
+            zone_live = 0;
+            zone_largest = 0;
+            used = ZONE_HEADER_SIZE;
+            report->zones[entry->zone_type]++;
+            report->mapped_bytes += entry->size;
+            report->overhead_bytes += ZONE_HEADER_SIZE;
+            /* one bit per page, per group of pages in chunks over 64 pages */
+            report->decommitted_bytes += count_bits(entry->decommitted) * getpagesize() *
+                ((entry->size / getpagesize() + 63) / 64);
+            continue;
+        }
+
+        user = entry->size - sizeof(t_block) - sizeof(t_footer);
+        used += entry->size;
+        report->overhead_bytes += sizeof(t_block) + sizeof(t_footer);
+        if (entry->kind == SNAP_USED)
+        {
+            report->live_bytes += user;
+            report->live_blocks++;
+            zone_live += user;
+        }
+        else
+        {
+            report->free_bytes += user;
+            report->free_blocks++;
+            report->free_by_bucket[free_bucket(user)]++;
+            if (user > zone_largest)
+                zone_largest = user;
+            if (zone->zone_type != LARGE && user > report->largest_free)
+                report->largest_free = user;
+            if (zone->zone_type != LARGE)
+                report->zone_free_bytes += user;
+        }
+
+        /* slack after the last block of a LARGE zone is overhead too */
+        if (zone && (i + 1 == snap->count || !SNAP_IS_BLOCK(snap->entries[i + 1].kind)))
+            report->overhead_bytes += zone->size - used;
+    }
+    if (zone)
+        finish_zone(report, zone, zone_live, zone_largest, per_zone);
+
+    /* 0 = all TINY/SMALL free space is one block, 1 = it is all scattered */
+    if (report->zone_free_bytes)
+        report->external_fragmentation = 1.0 -
+            (double)report->largest_free / (double)report->zone_free_bytes;
+}
+
+
+/*
+ * analyze a heap (NULL for the global state: every NUMA arena, and the
+ * object pools); per_zone, if not NULL, is called once per zone after the
+ * locks have been released. returns -1 if the snapshot could not be
+ * allocated
+ */
+int malloc_analyze(t_heap *heap, t_heap_report *report,
+    void (*per_zone)(const t_zone_report *))
+{
+    t_malloc_state  *states[NUMA_MAX_NODES];
+    t_snapshot      snap;
+    int             count;
+    int             node;
+    int             result;
+
+    malloc_init();
+    ft_bzero(report, sizeof(*report));
+    snap.entries = NULL;
+    snap.count = 0;
+    snap.capacity = 0;
+    snap.failed = false;
+
+    count = 0;
+    if (heap)
+        states[count++] = heap;
+    for (node = 0; !heap && node < NUMA_MAX_NODES; node++)
+    {
+        if (numa_arena_at(node))
+            states[count++] = numa_arena_at(node);
+    }
+    if (!heap)
+        pool_analyze(&report->pool_bytes, &report->pool_live_bytes,
+            &report->pool_magazine_bytes);
+
+    take_snapshot(&snap, states, count);
+    result = snap.failed ? -1 : 0;
+    if (!snap.failed)
+        analyze_snapshot(&snap, report, per_zone);
+
+    if (snap.entries)
+        munmap(snap.entries, snap.capacity * sizeof(t_snap_entry));
+    return result;
+}
+
+
+/* per-zone line of show_alloc_analysis */
+static void print_zone_report(const t_zone_report *zone)
+{
+    static const char   *names[] = {"tiny", "small", "medium", "large"};
+
+    printf("zone addr=%p type=%s size=%zu live=%zu largest_free=%zu nearly_empty=%d\n",
+        zone->zone, names[zone->zone_type], zone->zone_size,
+        zone->live_bytes, zone->largest_free, zone->nearly_empty);
+}
+
+
+/*
+ * print the analysis of a heap (NULL for the global state) as key=value
+ * lines, one line per zone first
+ */
+void show_alloc_analysis(t_heap *heap)
+{
+    t_heap_report   report;
+    int             i;
+
+    if (malloc_analyze(heap, &report, print_zone_report) != 0)
+    {
+        printf("analysis failed: could not map snapshot\n");
+        return;
+    }
+
+    printf("zones.tiny=%zu\n", report.zones[TINY]);
+    printf("zones.small=%zu\n", report.zones[SMALL]);
+    printf("zones.medium=%zu\n", report.zones[MEDIUM]);
+    printf("zones.large=%zu\n", report.zones[LARGE]);
+    printf("bytes.mapped=%zu\n", report.mapped_bytes);
+    printf("bytes.decommitted=%zu\n", report.decommitted_bytes);
+    printf("bytes.live=%zu\n", report.live_bytes);
+    printf("bytes.overhead=%zu\n", report.overhead_bytes);
+    printf("bytes.free=%zu\n", report.free_bytes);
+    printf("bytes.spare=%zu\n", report.spare_bytes);
+    printf("bytes.reclaimable=%zu\n", report.reclaimable_bytes);
+    printf("blocks.live=%zu\n", report.live_blocks);
+    printf("blocks.free=%zu\n", report.free_blocks);
+    printf("free.largest=%zu\n", report.largest_free);
+    for (i = 0; i < ANALYZE_FREE_BUCKETS; i++)
+    {
+        if (report.free_by_bucket[i])
+            printf("free.log2_bytes.%d=%zu\n", i, report.free_by_bucket[i]);
+    }
+    printf("zones.nearly_empty=%zu\n", report.nearly_empty_zones);
+    printf("fragmentation.external=%.4f\n", report.external_fragmentation);
+    printf("pool.mapped=%zu\n", report.pool_bytes);
+    printf("pool.live=%zu\n", report.pool_live_bytes);
+    printf("pool.magazines=%zu\n", report.pool_magazine_bytes);
+}
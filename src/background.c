@@ -0,0 +1,441 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   background.c                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+#include <signal.h>
+#include <time.h>
+
+/*
+ * Background maintenance thread.
+ *
+ * Off by default. Once enabled (malloc_background(1) or
+ * FT_MALLOC_BACKGROUND=1; FT_MALLOC_BACKGROUND=0 forbids it for good) the
+ * thread is started by the first malloc that follows a zone creation,
+ * never from inside a locked section: pthread_create may allocate itself,
+ * so not even the thread's own mutex is held across it.
+ *
+ * Every BACKGROUND_TICK_MS, or as soon as an allocating thread used up a
+ * ready zone, it reads the memory pressure and tops each NUMA arena up to
+ * BACKGROUND_READY_ZONES mapped and pre-faulted TINY and SMALL zones
+ * (twice that under low memory pressure, none under high pressure), which
+ * create_zone hands out before going to mmap. Every BACKGROUND_PURGE_MS it
+ * releases whole free pages (malloc_purge, skipped while memory is
+ * plentiful) and unmaps cached LARGE zones beyond what malloc_reserve
+ * asked for. Arenas with a malloc_reserve are never purged behind the back
+ * of their bounded-latency threads.
+ */
+
+#define BACKGROUND_OFF 0
+#define BACKGROUND_ON 1
+#define BACKGROUND_FORBIDDEN 2
+
+typedef struct s_background {
+    pthread_mutex_t mutex;      // guards everything below but the counters
+    pthread_cond_t  cond;       // wakes the thread early
+    pthread_t       thread;
+    int             mode;       // BACKGROUND_OFF / ON / FORBIDDEN
+    int             running;    // thread created and not joined yet
+    int             spawning;   // pthread_create in progress, mutex released
+    int             stop;       // asks the thread to exit
+    int             kicked;     // a ready zone was taken
+    size_t          zones_prepared;
+    size_t          purged_bytes;
+    size_t          large_trimmed;
+} t_background;
+
+static t_background g_background = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .mode = BACKGROUND_OFF
+};
+
+/* set under the state lock, acted on by the next malloc once unlocked */
+static int g_spawn_pending = 0;
+
+
+/* the condition variable waits on the monotonic clock */
+static void init_cond(void)
+{
+    pthread_condattr_t  attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_background.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+/* read FT_MALLOC_BACKGROUND; called once from malloc_init */
+void background_init(void)
+{
+    const char  *value;
+
+    init_cond();
+#ifdef MALLOC_SINGLE_THREADED
+    /* locking is compiled out, a second thread would corrupt the lists */
+    g_background.mode = BACKGROUND_FORBIDDEN;
+    return;
+#endif
+    value = getenv("FT_MALLOC_BACKGROUND");
+    if (value && value[0] == '0' && !value[1])
+        g_background.mode = BACKGROUND_FORBIDDEN;
+    else if (value && value[0] == '1' && !value[1])
+        g_background.mode = BACKGROUND_ON;
+}
+
+
+/*
+ * ready zones to keep per type and arena: more while memory is plentiful,
+ * none under memory pressure
+ */
+static size_t ready_watermark(void)
+{
+    if (pressure_level() == MALLOC_PRESSURE_HIGH)
+        return 0;
+    if (pressure_level() == MALLOC_PRESSURE_LOW)
+        return (BACKGROUND_READY_ZONES * 2);
+    return (BACKGROUND_READY_ZONES);
+}
+
+
+/*
+ * take a pre-faulted TINY/SMALL zone, state lock held; NULL when none is
+ * ready
+ */
+t_zone *ready_take_zone(t_malloc_state *state, t_zone_type zone_type)
+{
+    t_zone  *zone;
+
+    zone = state->ready[zone_type];
+    if (!zone)
+        return NULL;
+    state->ready[zone_type] = zone->next;
+    state->ready_count[zone_type]--;
+    zone->next = NULL;
+    return zone;
+}
+
+
+/*
+ * keep an emptied TINY/SMALL zone (already unlinked) as a ready zone
+ * instead of unmapping it, state lock held; false if the arena has enough.
+ * only NUMA arenas keep ready zones: those of heap_create heaps would be
+ * neither refilled, counted nor released by malloc_background(0)
+ */
+bool ready_put_zone(t_malloc_state *state, t_zone *zone)
+{
+    if (g_background.mode != BACKGROUND_ON ||
+        numa_arena_at(state->node < 0 ? 0 : state->node) != state ||
+        state->ready_count[zone->zone_type] >= ready_watermark())
+        return false;
+    init_zone(zone, zone->zone_type, zone->zone_size);
+    zone->next = state->ready[zone->zone_type];
+    state->ready[zone->zone_type] = zone;
+    state->ready_count[zone->zone_type]++;
+    return true;
+}
+
+
+/* true while the thread exists, so others can leave its work to it */
+bool background_running(void)
+{
+    return (__atomic_load_n(&g_background.running, __ATOMIC_RELAXED) != 0);
+}
+
+
+/*
+ * a zone was created on the allocation path: have the thread refill, or
+ * have it started. may run under a state lock, so it only flips flags;
+ * the thread's mutex is never held while a state lock is taken
+ */
+void background_wake(void)
+{
+    if (g_background.mode != BACKGROUND_ON)
+        return;
+    pthread_mutex_lock(&g_background.mutex);
+    /* while spawning, the new thread does a full round first anyway */
+    if (!g_background.running && !g_background.spawning)
+        g_spawn_pending = 1;
+    else if (g_background.running)
+    {
+        g_background.kicked = 1;
+        pthread_cond_signal(&g_background.cond);
+    }
+    pthread_mutex_unlock(&g_background.mutex);
+}
+
+
+/* top the ready list of one zone type up to the watermark */
+static void refill_ready(t_malloc_state *state, t_zone_type zone_type)
+{
+    t_zone  *zone;
+    size_t  count;
+
+    while (!g_background.stop)
+    {
+        malloc_lock(&state->lock);
+        count = state->ready_count[zone_type];
+        malloc_unlock(&state->lock);
+        if (count >= ready_watermark())
+            return;
+
+        /* map and fault the pages in before anyone can see the zone */
+        zone = map_zone(zone_type, 0, state->node);
+        if (!zone)
+            return;
+        prefault_zone(zone, 0);
+
+        malloc_lock(&state->lock);
+        zone->next = state->ready[zone_type];
+        state->ready[zone_type] = zone;
+        state->ready_count[zone_type]++;
+        malloc_unlock(&state->lock);
+        __sync_fetch_and_add(&g_background.zones_prepared, 1);
+    }
+}
+
+
+/* one round of maintenance over every arena */
+static void background_tick(bool purge)
+{
+    t_malloc_state  *arena;
+    int             node;
+
+    pressure_poll();
+    for (node = 0; node < NUMA_MAX_NODES; node++)
+    {
+        arena = numa_arena_at(node);
+        if (!arena)
+            continue;
+        refill_ready(arena, TINY);
+        refill_ready(arena, SMALL);
+        if (!purge)
+            continue;
+        __sync_fetch_and_add(&g_background.large_trimmed, large_cache_trim(arena));
+        if (!arena->reserved && pressure_level() != MALLOC_PRESSURE_LOW)
+            __sync_fetch_and_add(&g_background.purged_bytes, state_purge(arena));
+    }
+}
+
+
+static void *background_main(void *arg)
+{
+    struct timespec deadline;
+    uint64_t        last_purge;
+    uint64_t        wake;
+    bool            purge;
+
+    (void)arg;
+    last_purge = now_ms();
+    pthread_mutex_lock(&g_background.mutex);
+    while (!g_background.stop)
+    {
+        g_background.kicked = 0;
+        pthread_mutex_unlock(&g_background.mutex);
+
+        purge = now_ms() - last_purge >= BACKGROUND_PURGE_MS;
+        if (purge)
+            last_purge = now_ms();
+        background_tick(purge);
+
+        pthread_mutex_lock(&g_background.mutex);
+        if (!g_background.stop && !g_background.kicked)
+        {
+            wake = now_ms() + BACKGROUND_TICK_MS;
+            deadline.tv_sec = wake / 1000;
+            deadline.tv_nsec = (wake % 1000) * 1000000;
+            pthread_cond_timedwait(&g_background.cond, &g_background.mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&g_background.mutex);
+    return NULL;
+}
+
+
+/* ask the thread to exit and wait for it; no-op when it is not running */
+static void background_stop(void)
+{
+    pthread_t   thread;
+
+    pthread_mutex_lock(&g_background.mutex);
+    if (!g_background.running || g_background.stop)
+    {
+        pthread_mutex_unlock(&g_background.mutex);
+        return;
+    }
+    g_background.stop = 1;
+    thread = g_background.thread;
+    pthread_cond_signal(&g_background.cond);
+    pthread_mutex_unlock(&g_background.mutex);
+
+    pthread_join(thread, NULL);
+
+    pthread_mutex_lock(&g_background.mutex);
+    g_background.running = 0;
+    g_background.stop = 0;
+    pthread_mutex_unlock(&g_background.mutex);
+}
+
+
+/*
+ * start the thread if a zone creation asked for it; called by malloc with
+ * no allocator lock held. the thread blocks every signal. pthread_create
+ * runs with the mutex released (it may allocate, and that allocation may
+ * wake us): the spawning flag keeps a second spawn and the wake-ups out
+ */
+void background_spawn(void)
+{
+    pthread_attr_t  attr;
+    pthread_t       thread;
+    sigset_t        all;
+    sigset_t        old;
+    int             created;
+    int             mode;
+
+    if (!g_spawn_pending || !__sync_bool_compare_and_swap(&g_spawn_pending, 1, 0))
+        return;
+
+    pthread_mutex_lock(&g_background.mutex);
+    if (g_background.mode != BACKGROUND_ON || g_background.running ||
+        g_background.spawning)
+    {
+        pthread_mutex_unlock(&g_background.mutex);
+        return;
+    }
+    g_background.spawning = 1;
+    g_background.stop = 0;
+    pthread_mutex_unlock(&g_background.mutex);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BACKGROUND_STACK);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    created = pthread_create(&thread, &attr, background_main, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+
+    pthread_mutex_lock(&g_background.mutex);
+    g_background.spawning = 0;
+    if (created)
+    {
+        g_background.thread = thread;
+        g_background.running = 1;
+    }
+    mode = g_background.mode;
+    pthread_mutex_unlock(&g_background.mutex);
+
+    /* malloc_background(0) found no thread to stop while it was created */
+    if (created && mode != BACKGROUND_ON)
+        background_stop();
+}
+
+
+/* hand the ready zones of an arena back to the system */
+void ready_release(t_malloc_state *state)
+{
+    t_zone_type zone_type;
+    t_zone      *zone;
+
+    malloc_lock(&state->lock);
+    for (zone_type = TINY; zone_type <= SMALL; zone_type++)
+    {
+        while ((zone = ready_take_zone(state, zone_type)))
+            munmap(zone, zone->zone_size);
+    }
+    malloc_unlock(&state->lock);
+}
+
+
+/*
+ * enable (on != 0) or disable the background thread. enabling only allows
+ * it, the thread starts with the next zone creation; disabling stops it,
+ * waits for it and releases the ready zones. returns -1 if
+ * FT_MALLOC_BACKGROUND=0 forbids the thread
+ */
+int malloc_background(int on)
+{
+    int node;
+
+    malloc_init();
+
+    pthread_mutex_lock(&g_background.mutex);
+    if (g_background.mode == BACKGROUND_FORBIDDEN)
+    {
+        pthread_mutex_unlock(&g_background.mutex);
+        return -1;
+    }
+    g_background.mode = on ? BACKGROUND_ON : BACKGROUND_OFF;
+    pthread_mutex_unlock(&g_background.mutex);
+    if (on)
+        return 0;
+
+    g_spawn_pending = 0;
+    background_stop();
+    for (node = 0; node < NUMA_MAX_NODES; node++)
+    {
+        if (numa_arena_at(node))
+            ready_release(numa_arena_at(node));
+    }
+    return 0;
+}
+
+
+/* copy the counters and the number of ready zones over all arenas */
+int malloc_background_stats(t_background_stats *stats)
+{
+    t_malloc_state  *arena;
+    int             node;
+
+    pthread_mutex_lock(&g_background.mutex);
+    stats->enabled = g_background.mode == BACKGROUND_ON;
+    stats->running = g_background.running;
+    pthread_mutex_unlock(&g_background.mutex);
+    stats->zones_prepared = g_background.zones_prepared;
+    stats->purged_bytes = g_background.purged_bytes;
+    stats->large_trimmed = g_background.large_trimmed;
+
+    stats->zones_ready = 0;
+    for (node = 0; node < NUMA_MAX_NODES; node++)
+    {
+        arena = numa_arena_at(node);
+        if (!arena)
+            continue;
+        malloc_lock(&arena->lock);
+        stats->zones_ready += arena->ready_count[TINY] + arena->ready_count[SMALL];
+        malloc_unlock(&arena->lock);
+    }
+    return 0;
+}
+
+
+/*
+ * after fork, in the child: the thread did not survive. its mutex may have
+ * been held, so everything is reset; it is started again on demand
+ */
+void background_atfork_child(void)
+{
+    pthread_mutex_init(&g_background.mutex, NULL);
+    init_cond();
+    g_background.running = 0;
+    g_background.spawning = 0;
+    g_background.stop = 0;
+    g_background.kicked = 0;
+    g_spawn_pending = 0;
+}
+
+
+/* stop the thread before the library goes away */
+__attribute__((destructor))
+static void background_shutdown(void)
+{
+    background_stop();
+}
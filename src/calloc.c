@@ -0,0 +1,35 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   calloc.c                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/*
+ * calloc implementation. memory that is still zero since it was mapped,
+ * or since it was released with MADV_DONTNEED, is not touched again, so a
+ * large calloc served from a fresh mapping costs no more than the mmap
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t  total;
+    void    *ptr;
+
+    if (__builtin_mul_overflow(nmemb, size, &total))
+        return NULL;
+
+    /* ensuring initialization */
+    malloc_init();
+
+    ptr = state_calloc(numa_arena(), total);
+    background_spawn();
+    pressure_check();
+    return (ptr);
+}
@@ -0,0 +1,59 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   fork.c                                             :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+extern t_malloc_state g_malloc_state;
+
+/*
+ * Lock order, used by every handler below:
+ *   1. pool registry lock
+ *   2. each pool lock, in registry order
+ *   3. heap registry lock
+ *   4. each user heap lock, in registry order
+ *   5. global state lock
+ * Holding all of them across fork() guarantees no zone list is half
+ * updated when the child's copy of memory is taken.
+ */
+
+
+/* before fork: acquire every allocator lock */
+void malloc_atfork_prepare(void)
+{
+    pool_lock_all();
+    heap_lock_all();
+    malloc_lock(&g_malloc_state.lock);
+}
+
+
+/* after fork, in the parent: release in reverse order */
+void malloc_atfork_parent(void)
+{
+    malloc_unlock(&g_malloc_state.lock);
+    heap_unlock_all();
+    pool_unlock_all();
+}
+
+
+/*
+ * after fork, in the child: only the forking thread survives, so locks are
+ * reset rather than unlocked. this is O(number of heaps), no zone walks
+ */
+void malloc_atfork_child(void)
+{
+    lock_init(&g_malloc_state.lock);
+    heap_reset_locks();
+    pool_reset_locks();
+    trace_atfork_child();
+    background_atfork_child();
+    pressure_atfork_child();
+}
@@ -15,16 +15,12 @@
 extern t_malloc_state g_malloc_state;
 
 /*
- * find the zone containing the given pointer
+ * find the block of ptr in a list of TINY/SMALL zones
  */
-static t_zone *find_zone_for_ptr(void *ptr, t_block **block_ptr)
+static t_zone *find_in_zone_list(t_zone *zone, void *ptr, t_block **block_ptr)
 {
-    t_zone  *zone;
-    t_block *block; 
-    
+    t_block *block;
 
-    /* try tiny zones */
-    zone = g_malloc_state.tiny_zones;
     while (zone)
     {
         if ((uintptr_t)ptr >= (uintptr_t)zone &&
@@ -49,36 +45,30 @@ static t_zone *find_zone_for_ptr(void *ptr, t_block **block_ptr)
         }
         zone = zone->next;
     }
+    return NULL;
+}
 
-    /* try small zones */
-    zone = g_malloc_state.small_zones;
-    while (zone)
-    {
-        if ((uintptr_t)ptr >= (uintptr_t)zone &&
-            (uintptr_t)ptr < (uintptr_t)zone + zone->zone_size)
-        {
-            /* found zone now finding block */
-            block = zone->first;
-            while (block)
-            {
-                if (PTR_FROM_BLOCK(block) == ptr)
-                {
-                    *block_ptr = block;
-                    return zone;
-                }
 
-                /* move to the next physical block */
-                if ((char *)block + block->size < (char *)zone + zone->zone_size)
-                    block = (t_block *)((char *)block + block->size);
-                else
-                    break;
-            }
-        }
-        zone = zone->next;
-    }
+/*
+ * find the zone containing the given pointer
+ */
+t_zone *find_zone_for_ptr(t_malloc_state *state, void *ptr, t_block **block_ptr)
+{
+    t_zone  *zone;
+    t_block *block; 
+    
+
+    /* medium chunks come from the chunk map, then tiny and small zones */
+    zone = medium_find(state, ptr, block_ptr);
+    if (!zone)
+        zone = find_in_zone_list(state->tiny_zones, ptr, block_ptr);
+    if (!zone)
+        zone = find_in_zone_list(state->small_zones, ptr, block_ptr);
+    if (zone)
+        return zone;
 
     /* try large zones */
-    zone = g_malloc_state.large_zones;
+    zone = state->large_zones;
     while (zone)
     {
         if ((uintptr_t)ptr >= (uintptr_t)zone &&
@@ -100,19 +90,20 @@ static t_zone *find_zone_for_ptr(void *ptr, t_block **block_ptr)
 
 
 /* free a large zone */
-static void free_large_zone(t_zone *zone)
+static void free_large_zone(t_malloc_state *state, t_zone *zone)
 {
     t_zone *prev;
     t_zone *current;
+    size_t zone_size;
 
     /* remove zone from list */
-    if (g_malloc_state.large_zones == zone)
+    if (state->large_zones == zone)
     {
-        g_malloc_state.large_zones = zone->next;
+        state->large_zones = zone->next;
     }
     else
     {
-        prev = g_malloc_state.large_zones;
+        prev = state->large_zones;
         current = prev->next;
 
         while (current)
@@ -127,8 +118,17 @@ static void free_large_zone(t_zone *zone)
         }
     }
 
-    /* unmap memory */
-    munmap(zone, zone->zone_size);
+    /* unmap memory, or keep it for a bounded-latency thread */
+    TRACE_START(start);
+    zone_size = zone->zone_size;
+    if (thread_reserve_only())
+    {
+        zone->next = state->large_cache;
+        state->large_cache = zone;
+    }
+    else
+        munmap(zone, zone_size);
+    TRACE_END(TRACE_LARGE_FREE, zone_size, start);
 }
 
 
@@ -144,41 +144,100 @@ static bool can_free_zone(t_zone *zone)
     if (zone->zone_type == LARGE)
         return true;
 
+    /* the bootstrap zones live in .bss */
+    if (zone_is_bootstrap(zone))
+        return false;
+
     
     /* for tiny/small zones, check if all space is in one free block */
     if (zone->first && zone->first->is_free && 
-        zone->first->size == zone->zone_size - sizeof(t_zone) && 
-        zone->first->next == NULL)
+        zone->first->size == zone->zone_size - ZONE_HEADER_SIZE)
         return true;
 
     return false;
 }
 
 
+/*
+ * unmap every completely free TINY/SMALL/MEDIUM zone of a state, also the
+ * ones kept as the last of their list; returns the bytes released
+ */
+size_t state_release_empty(t_malloc_state *state)
+{
+    t_zone  **lists[3];
+    t_zone  **link;
+    t_zone  *zone;
+    t_zone  *empty;
+    size_t  released;
+    int     i;
 
+    lists[0] = &state->tiny_zones;
+    lists[1] = &state->small_zones;
+    lists[2] = &state->medium_zones;
+    empty = NULL;
 
-/* free implementation */
-void free(void *ptr)
+    malloc_lock(&state->lock);
+    for (i = 0; i < 3; i++)
+    {
+        link = lists[i];
+        while ((zone = *link))
+        {
+            if (!can_free_zone(zone))
+            {
+                link = &zone->next;
+                continue;
+            }
+            *link = zone->next;
+            if (zone->zone_type == MEDIUM)
+            {
+                medium_unbin(state, zone->first);
+                medium_forget(zone);
+            }
+            zone->next = empty;
+            empty = zone;
+        }
+    }
+    malloc_unlock(&state->lock);
+
+    /* no lock needed for the unmapping, nobody can reach them any more */
+    released = 0;
+    while ((zone = empty))
+    {
+        empty = zone->next;
+        released += zone->zone_size;
+        munmap(zone, zone->zone_size);
+    }
+    return released;
+}
+
+
+/* release a pointer back to the zone lists of the given state */
+void state_free(t_malloc_state *state, void *ptr)
 {
     t_zone  *zone;
     t_block *block;
     t_zone  *prev_zone;
     t_zone  *current_zone;
+    size_t  zone_size;
 
 
     /* handle null pointer */
     if (!ptr)
         return;
 
+    /* LARGE zones in the registry are released without the lock */
+    if (large_release(state, ptr))
+        return;
+
     /* locking for thread safety */
-    pthread_mutex_lock(&g_malloc_state.mutex);
+    malloc_lock(&state->lock);
 
     /* find zone and block this pointer */
-    zone = find_zone_for_ptr(ptr, &block);
+    zone = find_zone_for_ptr(state, ptr, &block);
     if (!zone || !block || block->is_free)
     {
         /* invalid pointer, ignore */
-        pthread_mutex_unlock(&g_malloc_state.mutex);
+        malloc_unlock(&state->lock);
         return;
     }
 
@@ -187,28 +246,49 @@ void free(void *ptr)
     block->is_free = 1;
     zone->free_blocks++;
 
+    /* coalesce with free neighbours so the space can be reused whole */
+    if (zone->zone_type == MEDIUM)
+        block = medium_free(state, zone, block);
+    else if (zone->zone_type != LARGE)
+        block = merge_free_blocks(zone, block);
+
 
     /* check if zone can be completely freed */
     if (can_free_zone(zone))
     {
         if (zone->zone_type == LARGE)
         {
-            free_large_zone(zone);
+            free_large_zone(state, zone);
+            zone = NULL;
         }
         else
         {
-            /* for tiny/small zones, only free if we have other zones */
+            /* for tiny/small/medium zones, only free if we have other zones */
             t_zone **zone_list;
 
             if (zone->zone_type == TINY)
-                zone_list = &g_malloc_state.tiny_zones;
+                zone_list = &state->tiny_zones;
+            else if (zone->zone_type == SMALL)
+                zone_list = &state->small_zones;
             else
-                zone_list = &g_malloc_state.small_zones;
+                zone_list = &state->medium_zones;
 
 
-            /* only free if we have at least one other zone */
-            if (*zone_list != zone || (*zone_list)->next != NULL)
+            /*
+             * only free if we have at least one other zone, or memory is
+             * short; a bounded-latency thread has nowhere to put a MEDIUM
+             * chunk, so it stays
+             */
+            if ((*zone_list != zone || (*zone_list)->next != NULL ||
+                    pressure_level() == MALLOC_PRESSURE_HIGH) &&
+                !(zone->zone_type == MEDIUM && thread_reserve_only()))
             {
+                if (zone->zone_type == MEDIUM)
+                {
+                    medium_unbin(state, block);
+                    medium_forget(zone);
+                }
+
                 /* removing zone from list */
                 if (*zone_list == zone)
                 {
@@ -231,12 +311,39 @@ void free(void *ptr)
                     }
                 }
 
-                /* free the zone */
-                munmap(zone, zone->zone_size);
+                /*
+                 * free the zone, hand it back to the reserve, or keep it
+                 * as a ready zone while the background thread is on
+                 */
+                TRACE_START(start);
+                zone_size = zone->zone_size;
+                if (thread_reserve_only())
+                    reserve_put_zone(state, zone);
+                else if (zone->zone_type == MEDIUM || !ready_put_zone(state, zone))
+                    munmap(zone, zone_size);
+                TRACE_END(TRACE_ZONE_UNMAP, zone_size, start);
+                zone = NULL;
             }
         }
     }
 
+    /*
+     * a zone that stays mapped gives back the interior of big free spans
+     * (how big depends on memory pressure); not from a bounded-latency
+     * thread, which must not refault them later
+     */
+    if (zone && zone->zone_type != LARGE && !thread_reserve_only())
+        zone_purge_block(zone, block, pressure_purge_pages());
+
     /* unlock */
-    pthread_mutex_unlock(&g_malloc_state.mutex);
+    malloc_unlock(&state->lock);
+}
+
+
+/* free implementation */
+void free(void *ptr)
+{
+    if (ptr && lifetime_predicting())
+        lifetime_forget(ptr);
+    state_free(numa_owner(ptr), ptr);
 }
@@ -0,0 +1,204 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   heap.c                                             :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/* registry of live heaps, walked by the fork handlers */
+static t_heap           *g_heaps = NULL;
+static pthread_mutex_t  g_heaps_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * unmap every zone of a zone list
+ */
+static void unmap_zone_list(t_zone *zone)
+{
+    t_zone  *next;
+
+    while (zone)
+    {
+        next = zone->next;
+        if (zone->zone_type == MEDIUM)
+            medium_forget(zone);
+        munmap(zone, zone->zone_size);
+        zone = next;
+    }
+}
+
+
+/*
+ * create an empty heap with its own TINY/SMALL/MEDIUM/LARGE zone lists
+ */
+t_heap *heap_create(void)
+{
+    t_heap  *heap;
+    int     i;
+
+    malloc_init();
+
+    /* the heap header lives in its own page, independent of malloc */
+    heap = mmap(NULL, sizeof(t_heap), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap == MAP_FAILED)
+        return NULL;
+
+    heap->tiny_zones = NULL;
+    heap->small_zones = NULL;
+    heap->medium_zones = NULL;
+    for (i = 0; i < MEDIUM_BINS; i++)
+        heap->medium_bins[i] = NULL;
+    heap->large_zones = NULL;
+    heap->large.slots = NULL;
+    heap->large.walkers = 0;
+    heap->reserve[TINY] = NULL;
+    heap->reserve[SMALL] = NULL;
+    heap->reserve_count[TINY] = 0;
+    heap->reserve_count[SMALL] = 0;
+    heap->large_cache = NULL;
+    heap->reserved_large = 0;
+    heap->reserved = 0;
+    heap->ready[TINY] = NULL;
+    heap->ready[SMALL] = NULL;
+    heap->ready_count[TINY] = 0;
+    heap->ready_count[SMALL] = 0;
+    heap->node = -1;
+    if (lock_init(&heap->lock) != 0)
+    {
+        munmap(heap, sizeof(t_heap));
+        return NULL;
+    }
+
+    /* register the heap so fork can take its lock */
+    pthread_mutex_lock(&g_heaps_mutex);
+    heap->next = g_heaps;
+    g_heaps = heap;
+    pthread_mutex_unlock(&g_heaps_mutex);
+
+    return heap;
+}
+
+
+/*
+ * allocate from a heap's zones only
+ */
+void *heap_malloc(t_heap *heap, size_t size)
+{
+    if (!heap)
+        return NULL;
+
+    return (state_malloc(heap, size));
+}
+
+
+/*
+ * free a pointer previously returned by heap_malloc on the same heap
+ */
+void heap_free(t_heap *heap, void *ptr)
+{
+    if (!heap)
+        return;
+
+    state_free(heap, ptr);
+}
+
+
+/*
+ * release every zone of the heap in one sweep, then the heap itself;
+ * pointers obtained from the heap are invalid afterwards
+ */
+void heap_destroy(t_heap *heap)
+{
+    t_heap  **link;
+
+    if (!heap)
+        return;
+
+    /* unregister first so a concurrent fork no longer sees it */
+    pthread_mutex_lock(&g_heaps_mutex);
+    link = &g_heaps;
+    while (*link && *link != heap)
+        link = &(*link)->next;
+    if (*link)
+        *link = heap->next;
+    pthread_mutex_unlock(&g_heaps_mutex);
+
+    malloc_lock(&heap->lock);
+    unmap_zone_list(heap->tiny_zones);
+    unmap_zone_list(heap->small_zones);
+    unmap_zone_list(heap->medium_zones);
+    unmap_zone_list(heap->large_zones);
+    unmap_zone_list(heap->reserve[TINY]);
+    unmap_zone_list(heap->reserve[SMALL]);
+    unmap_zone_list(heap->large_cache);
+    unmap_zone_list(heap->ready[TINY]);
+    unmap_zone_list(heap->ready[SMALL]);
+    large_destroy(heap);
+    heap->tiny_zones = NULL;
+    heap->small_zones = NULL;
+    heap->medium_zones = NULL;
+    heap->large_zones = NULL;
+    malloc_unlock(&heap->lock);
+
+    lock_destroy(&heap->lock);
+    munmap(heap, sizeof(t_heap));
+}
+
+
+/*
+ * fork support: take the registry lock, then every heap lock in list order.
+ * the registry lock stays held until heap_unlock_all/heap_reset_locks
+ */
+void heap_lock_all(void)
+{
+    t_heap  *heap;
+
+    pthread_mutex_lock(&g_heaps_mutex);
+    heap = g_heaps;
+    while (heap)
+    {
+        malloc_lock(&heap->lock);
+        heap = heap->next;
+    }
+}
+
+
+/*
+ * release what heap_lock_all acquired (parent side of fork)
+ */
+void heap_unlock_all(void)
+{
+    t_heap  *heap;
+
+    heap = g_heaps;
+    while (heap)
+    {
+        malloc_unlock(&heap->lock);
+        heap = heap->next;
+    }
+    pthread_mutex_unlock(&g_heaps_mutex);
+}
+
+
+/*
+ * child side of fork: the child is single threaded, so every lock is
+ * simply reinitialized; only the heap headers are touched, never zones
+ */
+void heap_reset_locks(void)
+{
+    t_heap  *heap;
+
+    heap = g_heaps;
+    while (heap)
+    {
+        lock_init(&heap->lock);
+        heap = heap->next;
+    }
+    pthread_mutex_init(&g_heaps_mutex, NULL);
+}
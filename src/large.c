@@ -0,0 +1,232 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   large.c                                            :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/*
+ * LARGE zones are tracked in a per-state open-addressed hash table keyed by
+ * the zone address. Slots only ever move NULL -> zone -> TOMBSTONE -> zone,
+ * always by CAS, so registering and unregistering need no lock. The mutex
+ * is only taken by threads that dereference zone headers found in the
+ * table (show_alloc_mem), and free waits for those.
+ *
+ * A tombstone is never turned back into NULL: a register that probed past
+ * the slot while it was still taken could be left behind it. Instead every
+ * probe sequence stops after LARGE_REGISTRY_PROBES slots, so a lookup costs
+ * the same however many zones went through the table, and a register
+ * reuses the first tombstone of its window.
+ */
+
+#define REGISTRY_BYTES (LARGE_REGISTRY_SLOTS * sizeof(t_zone *))
+
+
+/* hash a zone address to its home slot */
+static size_t slot_for(t_zone *zone)
+{
+    return (((uintptr_t)zone >> 12) * 0x9E3779B97F4A7C15ULL) % LARGE_REGISTRY_SLOTS;
+}
+
+
+/* get the slot table, mapping it on first use */
+static t_zone **get_slots(t_malloc_state *state)
+{
+    t_zone  **slots;
+
+    slots = __atomic_load_n(&state->large.slots, __ATOMIC_ACQUIRE);
+    if (slots)
+        return slots;
+
+    slots = mmap(NULL, REGISTRY_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED)
+        return NULL;
+
+    /* another thread may have won the race */
+    if (!__sync_bool_compare_and_swap(&state->large.slots, NULL, slots))
+    {
+        munmap(slots, REGISTRY_BYTES);
+        slots = __atomic_load_n(&state->large.slots, __ATOMIC_ACQUIRE);
+    }
+    return slots;
+}
+
+
+/*
+ * publish a fully initialized LARGE zone; false if the probe window is
+ * full or the table could not be mapped, in which case the caller uses the
+ * locked list
+ */
+bool large_register(t_malloc_state *state, t_zone *zone)
+{
+    t_zone  **slots;
+    t_zone  *current;
+    size_t  index;
+    size_t  probes;
+
+    slots = get_slots(state);
+    if (!slots)
+        return false;
+
+    index = slot_for(zone);
+    for (probes = 0; probes < LARGE_REGISTRY_PROBES; probes++)
+    {
+        current = __atomic_load_n(&slots[index], __ATOMIC_RELAXED);
+        if ((current == NULL || current == LARGE_SLOT_TOMBSTONE) &&
+            __sync_bool_compare_and_swap(&slots[index], current, zone))
+            return true;
+        index = (index + 1) % LARGE_REGISTRY_SLOTS;
+    }
+    return false;
+}
+
+
+/*
+ * locate the registry slot holding the zone that ptr would belong to if
+ * it were a LARGE pointer. candidate addresses are only compared, never
+ * dereferenced. returns NULL if ptr is not a registered LARGE pointer
+ */
+static t_zone **find_slot(t_malloc_state *state, void *ptr, t_zone **zone_ptr)
+{
+    t_zone  **slots;
+    t_zone  *zone;
+    t_zone  *current;
+    size_t  index;
+    size_t  probes;
+
+    slots = __atomic_load_n(&state->large.slots, __ATOMIC_ACQUIRE);
+    if (!slots)
+        return NULL;
+
+    /* a LARGE zone is page aligned and holds a single block */
+    zone = (t_zone *)((char *)BLOCK_FROM_PTR(ptr) - ZONE_HEADER_SIZE);
+    if ((uintptr_t)zone & (getpagesize() - 1))
+        return NULL;
+
+    index = slot_for(zone);
+    for (probes = 0; probes < LARGE_REGISTRY_PROBES; probes++)
+    {
+        current = __atomic_load_n(&slots[index], __ATOMIC_ACQUIRE);
+        if (current == NULL)
+            return NULL;
+        if (current == zone)
+        {
+            *zone_ptr = zone;
+            return (&slots[index]);
+        }
+        index = (index + 1) % LARGE_REGISTRY_SLOTS;
+    }
+    return NULL;
+}
+
+
+/*
+ * get the registered LARGE zone owning ptr, or NULL
+ */
+t_zone *large_find(t_malloc_state *state, void *ptr)
+{
+    t_zone  *zone;
+
+    if (!find_slot(state, ptr, &zone))
+        return NULL;
+    return zone;
+}
+
+
+/*
+ * free path for LARGE pointers: if ptr is the user pointer of a registered
+ * zone, unregister and unmap it and return true
+ */
+bool large_release(t_malloc_state *state, void *ptr)
+{
+    t_zone  **slot;
+    t_zone  *zone;
+    size_t  zone_size;
+
+    slot = find_slot(state, ptr, &zone);
+    if (!slot)
+        return false;
+
+    /* losing this race means a concurrent double free: ignore it */
+    if (!__sync_bool_compare_and_swap(slot, zone, LARGE_SLOT_TOMBSTONE))
+        return true;
+
+    /* bounded-latency threads keep the zone instead of unmapping it */
+    TRACE_START(start);
+    zone_size = zone->zone_size;
+    if (thread_reserve_only())
+        large_cache_put(state, zone);
+    /* a walker may still be reading this header: wait for it */
+    else if (__atomic_load_n(&state->large.walkers, __ATOMIC_SEQ_CST) > 0)
+    {
+        malloc_lock(&state->lock);
+        munmap(zone, zone_size);
+        malloc_unlock(&state->lock);
+    }
+    else
+        munmap(zone, zone_size);
+    TRACE_END(TRACE_LARGE_FREE, zone_size, start);
+    return true;
+}
+
+
+/*
+ * announce / end a walk over registered zones; must be called with the
+ * state mutex held for the whole walk
+ */
+void large_walk_begin(t_malloc_state *state)
+{
+    __atomic_add_fetch(&state->large.walkers, 1, __ATOMIC_SEQ_CST);
+}
+
+void large_walk_end(t_malloc_state *state)
+{
+    __atomic_sub_fetch(&state->large.walkers, 1, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * iterate registered zones: start with *cursor = 0, returns NULL when done
+ */
+t_zone *large_next(t_malloc_state *state, size_t *cursor)
+{
+    t_zone  **slots;
+    t_zone  *zone;
+
+    slots = __atomic_load_n(&state->large.slots, __ATOMIC_ACQUIRE);
+    if (!slots)
+        return NULL;
+
+    while (*cursor < LARGE_REGISTRY_SLOTS)
+    {
+        zone = __atomic_load_n(&slots[(*cursor)++], __ATOMIC_ACQUIRE);
+        if (zone && zone != LARGE_SLOT_TOMBSTONE)
+            return zone;
+    }
+    return NULL;
+}
+
+
+/*
+ * unmap every registered zone and the table itself (heap_destroy)
+ */
+void large_destroy(t_malloc_state *state)
+{
+    t_zone  *zone;
+    size_t  cursor;
+
+    cursor = 0;
+    while ((zone = large_next(state, &cursor)))
+        munmap(zone, zone->zone_size);
+
+    if (state->large.slots)
+        munmap(state->large.slots, REGISTRY_BYTES);
+    state->large.slots = NULL;
+}
@@ -0,0 +1,302 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   lifetime.c                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/*
+ * Lifetime prediction per call site.
+ *
+ * One TINY/SMALL allocation in LIFETIME_SAMPLE_RATE per thread is recorded
+ * in a small table, hashed by address, with the return address of its
+ * malloc call and the sample clock (samples taken so far). Each sample
+ * later casts one vote for its call site:
+ *
+ *   freed before LIFETIME_SHORT_AGE more samples were taken    short
+ *   still live at that age, when freed, pushed out of its
+ *   slot by a newer sample or passed by the sweep              long
+ *
+ * The sweep looks at one slot per sample taken, in turn, so a block that
+ * stays live is counted within LIFETIME_SAMPLES samples whatever its hash.
+ *
+ * A site with LIFETIME_MIN_VOTES votes, one kind outnumbering the other
+ * LIFETIME_MAJORITY times, gets its allocations hinted like
+ * malloc_hinted would. Votes are halved past LIFETIME_MAX_VOTES so a site
+ * whose behaviour changes is reclassified.
+ *
+ * Everything here is lock-free: the site table is claimed with CAS, a
+ * sample slot is held with a test-and-set flag and skipped when busy.
+ * Losing the odd sample costs nothing, and no lock is left behind by fork.
+ */
+
+/* site table entries tried per lookup */
+#define LIFETIME_PROBES 8
+
+typedef struct s_lifetime_sample {
+    char        busy;
+    void        *ptr;           // sampled block, NULL = free slot
+    void        *site;
+    uint64_t    born;           // sample clock when it was taken
+} t_lifetime_sample;
+
+typedef struct s_lifetime_site {
+    void        *site;          // return address, NULL = free entry
+    uint32_t    short_votes;
+    uint32_t    long_votes;
+} t_lifetime_site;
+
+static t_lifetime_sample    g_samples[LIFETIME_SAMPLES];
+static t_lifetime_site      g_sites[LIFETIME_SITES];
+static uint64_t             g_clock = 0;
+static int                  g_predicting = 0;
+
+static __thread unsigned int t_allocs = 0;
+
+
+/* FT_MALLOC_LIFETIME=1 turns prediction on from the start */
+void lifetime_init(void)
+{
+    const char  *value;
+
+    value = getenv("FT_MALLOC_LIFETIME");
+    if (value && value[0] == '1' && !value[1])
+        g_predicting = 1;
+}
+
+
+bool lifetime_predicting(void)
+{
+    return (__atomic_load_n(&g_predicting, __ATOMIC_RELAXED) != 0);
+}
+
+
+/* spread addresses over a power-of-two table */
+static size_t hash_ptr(void *ptr)
+{
+    uint64_t    value;
+
+    value = (uintptr_t)ptr >> 4;
+    value *= 0x9E3779B97F4A7C15ULL;
+    return ((size_t)(value >> 32));
+}
+
+
+/* the entry of a call site, claimed if asked and there is room */
+static t_lifetime_site *find_site(void *site, bool claim)
+{
+    t_lifetime_site *entry;
+    void            *seen;
+    size_t          slot;
+    int             i;
+
+    slot = hash_ptr(site);
+    for (i = 0; i < LIFETIME_PROBES; i++)
+    {
+        entry = &g_sites[(slot + i) & (LIFETIME_SITES - 1)];
+        seen = __atomic_load_n(&entry->site, __ATOMIC_ACQUIRE);
+        if (seen == site)
+            return entry;
+        if (seen)
+            continue;
+        if (!claim)
+            return NULL;
+        if (__atomic_compare_exchange_n(&entry->site, &seen, site, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) || seen == site)
+            return entry;
+    }
+    return NULL;
+}
+
+
+/* lifetime class the votes of a site point to */
+static uint32_t classify(t_lifetime_site *entry)
+{
+    uint32_t    short_votes;
+    uint32_t    long_votes;
+
+    short_votes = __atomic_load_n(&entry->short_votes, __ATOMIC_RELAXED);
+    long_votes = __atomic_load_n(&entry->long_votes, __ATOMIC_RELAXED);
+    if (short_votes + long_votes < LIFETIME_MIN_VOTES)
+        return LIFETIME_DEFAULT;
+    if (short_votes >= long_votes * LIFETIME_MAJORITY)
+        return LIFETIME_SHORT;
+    if (long_votes >= short_votes * LIFETIME_MAJORITY)
+        return LIFETIME_LONG;
+    return LIFETIME_DEFAULT;
+}
+
+
+/* one vote for a site; racing halvings may lose a vote, which is fine */
+static void vote(void *site, bool short_lived)
+{
+    t_lifetime_site *entry;
+    uint32_t        total;
+
+    entry = find_site(site, true);
+    if (!entry)
+        return;
+    if (short_lived)
+        __atomic_add_fetch(&entry->short_votes, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&entry->long_votes, 1, __ATOMIC_RELAXED);
+
+    total = __atomic_load_n(&entry->short_votes, __ATOMIC_RELAXED) +
+        __atomic_load_n(&entry->long_votes, __ATOMIC_RELAXED);
+    if (total > LIFETIME_MAX_VOTES)
+    {
+        __atomic_store_n(&entry->short_votes, entry->short_votes / 2, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->long_votes, entry->long_votes / 2, __ATOMIC_RELAXED);
+    }
+}
+
+
+/* lifetime class for an allocation made from site */
+uint32_t lifetime_predict(void *site)
+{
+    t_lifetime_site *entry;
+
+    entry = find_site(site, false);
+    if (!entry)
+        return LIFETIME_DEFAULT;
+    return (classify(entry));
+}
+
+
+/* retire the slot the sweep has reached if its block has lived long */
+static void sweep(uint64_t now)
+{
+    t_lifetime_sample   *sample;
+
+    sample = &g_samples[now & (LIFETIME_SAMPLES - 1)];
+    if (__atomic_test_and_set(&sample->busy, __ATOMIC_ACQUIRE))
+        return;
+    if (sample->ptr && now - sample->born >= LIFETIME_SHORT_AGE)
+    {
+        vote(sample->site, false);
+        __atomic_store_n(&sample->ptr, NULL, __ATOMIC_RELAXED);
+    }
+    __atomic_clear(&sample->busy, __ATOMIC_RELEASE);
+}
+
+
+/* count an allocation, sampling one in LIFETIME_SAMPLE_RATE */
+void lifetime_sample(void *ptr, void *site)
+{
+    t_lifetime_sample   *sample;
+    uint64_t            now;
+
+    if (!ptr || (++t_allocs & (LIFETIME_SAMPLE_RATE - 1)))
+        return;
+
+    now = __atomic_add_fetch(&g_clock, 1, __ATOMIC_RELAXED);
+    sweep(now);
+    sample = &g_samples[hash_ptr(ptr) & (LIFETIME_SAMPLES - 1)];
+    if (__atomic_test_and_set(&sample->busy, __ATOMIC_ACQUIRE))
+        return;
+
+    /* the block pushed out survived long enough, or we cannot tell */
+    if (sample->ptr && now - sample->born >= LIFETIME_SHORT_AGE)
+        vote(sample->site, false);
+    sample->site = site;
+    sample->born = now;
+    __atomic_store_n(&sample->ptr, ptr, __ATOMIC_RELAXED);
+    __atomic_clear(&sample->busy, __ATOMIC_RELEASE);
+}
+
+
+/* a block is being freed: if it was sampled, its site gets the vote */
+void lifetime_forget(void *ptr)
+{
+    t_lifetime_sample   *sample;
+    uint64_t            age;
+
+    sample = &g_samples[hash_ptr(ptr) & (LIFETIME_SAMPLES - 1)];
+    if (__atomic_load_n(&sample->ptr, __ATOMIC_RELAXED) != ptr)
+        return;
+    if (__atomic_test_and_set(&sample->busy, __ATOMIC_ACQUIRE))
+        return;
+
+    if (sample->ptr == ptr)
+    {
+        age = __atomic_load_n(&g_clock, __ATOMIC_RELAXED) - sample->born;
+        vote(sample->site, age < LIFETIME_SHORT_AGE);
+        __atomic_store_n(&sample->ptr, NULL, __ATOMIC_RELAXED);
+    }
+    __atomic_clear(&sample->busy, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * turn call-site prediction on or off, returns the previous setting.
+ * what was learnt so far is kept
+ */
+int malloc_lifetime_predict(int on)
+{
+    malloc_init();
+    return (__atomic_exchange_n(&g_predicting, on ? 1 : 0, __ATOMIC_RELAXED));
+}
+
+
+/* count the TINY/SMALL zones of a list per lifetime class */
+static void count_zones(t_zone *zone, size_t *zones)
+{
+    while (zone)
+    {
+        if (zone->lifetime <= LIFETIME_LONG)
+            zones[zone->lifetime]++;
+        zone = zone->next;
+    }
+}
+
+
+/* prediction state and how the zones of every arena are split by lifetime */
+int malloc_lifetime_stats(t_lifetime_stats *stats)
+{
+    t_malloc_state  *arena;
+    uint32_t        lifetime;
+    int             node;
+    int             i;
+
+    if (!stats)
+        return -1;
+    malloc_init();
+
+    stats->predicting = lifetime_predicting();
+    stats->sites = 0;
+    stats->sites_short = 0;
+    stats->sites_long = 0;
+    stats->samples = __atomic_load_n(&g_clock, __ATOMIC_RELAXED);
+    for (i = 0; i < LIFETIME_SITES; i++)
+    {
+        if (!__atomic_load_n(&g_sites[i].site, __ATOMIC_ACQUIRE))
+            continue;
+        stats->sites++;
+        lifetime = classify(&g_sites[i]);
+        if (lifetime == LIFETIME_SHORT)
+            stats->sites_short++;
+        else if (lifetime == LIFETIME_LONG)
+            stats->sites_long++;
+    }
+
+    for (i = 0; i < 3; i++)
+        stats->zones[i] = 0;
+    for (node = 0; node < NUMA_MAX_NODES; node++)
+    {
+        arena = numa_arena_at(node);
+        if (!arena)
+            continue;
+        malloc_lock(&arena->lock);
+        count_zones(arena->tiny_zones, stats->zones);
+        count_zones(arena->small_zones, stats->zones);
+        malloc_unlock(&arena->lock);
+    }
+    return 0;
+}
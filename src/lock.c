@@ -0,0 +1,248 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   lock.c                                             :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/*
+ * true while no other thread can touch an allocator lock. glibc clears
+ * __libc_single_threaded before the second thread starts and never sets
+ * it again; without it, locking is never skipped
+ */
+#if defined(__has_include)
+# if __has_include(<sys/single_threaded.h>)
+#  include <sys/single_threaded.h>
+#  ifndef MALLOC_SINGLE_THREADED
+#   define SINGLE_THREADED() (__libc_single_threaded)
+#  endif
+# endif
+#endif
+#ifdef MALLOC_SINGLE_THREADED
+# define SINGLE_THREADED() 1
+#endif
+#ifndef SINGLE_THREADED
+# define SINGLE_THREADED() 0
+#endif
+
+#ifdef MALLOC_ADAPTIVE_SPIN
+/*
+ * a contended thread retries trylock up to the lock's spin budget before
+ * parking in the kernel. the budget follows what recent waits needed: a
+ * win after n tries pulls it towards 2n, a wait that ended up parked
+ * halves it. a lock whose holders keep it long thus stops spinning, one
+ * held briefly spins just long enough. FT_MALLOC_LOCK_SPIN=<tries> caps
+ * the budget, 0 always parks
+ */
+static int  g_lock_spin = -1;
+
+
+/* read the spin cap once; getenv does not allocate */
+static int spin_limit(void)
+{
+    const char  *value;
+    int         spins;
+
+    if (g_lock_spin >= 0)
+        return g_lock_spin;
+
+    value = getenv("FT_MALLOC_LOCK_SPIN");
+    if (!value || *value < '0' || *value > '9')
+        spins = LOCK_SPIN_MAX;
+    else
+    {
+        spins = 0;
+        while (*value >= '0' && *value <= '9' && spins < 1000000)
+            spins = spins * 10 + (*value++ - '0');
+    }
+    g_lock_spin = spins;
+    return spins;
+}
+
+
+/* move the budget after a contended acquisition, called with the lock held */
+static void adapt_spin(t_lock *lock, int tries, bool parked)
+{
+    int spin;
+
+    spin = __atomic_load_n(&lock->spin, __ATOMIC_RELAXED);
+    if (parked)
+        spin /= 2;
+    else
+        spin += (2 * tries - spin) / 8;
+    if (spin < LOCK_SPIN_MIN)
+        spin = LOCK_SPIN_MIN;
+    if (spin > spin_limit())
+        spin = spin_limit();
+    __atomic_store_n(&lock->spin, spin, __ATOMIC_RELAXED);
+}
+#endif
+
+#ifdef MALLOC_LOCK_STATS
+# include <time.h>
+
+/* monotonic time in nanoseconds */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+/* record one contended acquisition, called with the lock held */
+static void record_wait(t_lock_stats *stats, uint64_t wait_ns)
+{
+    int bucket;
+
+    stats->contended++;
+    stats->total_wait_ns += wait_ns;
+    if (wait_ns > stats->max_wait_ns)
+        stats->max_wait_ns = wait_ns;
+
+    bucket = 0;
+    while (wait_ns > 1 && bucket < LOCK_STAT_BUCKETS - 1)
+    {
+        wait_ns >>= 1;
+        bucket++;
+    }
+    stats->buckets[bucket]++;
+}
+
+#endif
+
+
+/* initialize (or, in a fork child, reset) a lock; stats are kept */
+int lock_init(t_lock *lock)
+{
+    lock->elided = 0;
+#ifdef MALLOC_ADAPTIVE_SPIN
+    lock->spin = LOCK_SPIN_START;
+#endif
+    return (pthread_mutex_init(&lock->mutex, NULL));
+}
+
+
+void lock_destroy(t_lock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+}
+
+
+#ifdef MALLOC_SINGLE_THREADED
+/*
+ * locking is compiled out: a second thread would corrupt the zone lists
+ * without a trace, so malloc_lock and the zone mapping stop the program
+ * as soon as glibc reports one
+ */
+void lock_check_threads(void)
+{
+# if defined(__has_include)
+#  if __has_include(<sys/single_threaded.h>)
+    static const char   msg[] = "ft_malloc: built with SINGLE_THREADED=1 but the "
+                                "process has started a thread\n";
+
+    if (!__libc_single_threaded)
+    {
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        abort();
+    }
+#  endif
+# endif
+}
+#endif
+
+
+/* 1 while allocator locks are skipped */
+int malloc_single_threaded(void)
+{
+    return (SINGLE_THREADED() ? 1 : 0);
+}
+
+
+/*
+ * acquire an allocator lock. a single-threaded process skips it, the
+ * uncontended case is a single trylock; only a thread that has to wait
+ * spins (MALLOC_ADAPTIVE_SPIN), parks and pays for timing the wait
+ */
+void malloc_lock(t_lock *lock)
+{
+#ifdef MALLOC_LOCK_STATS
+    uint64_t    wait_start;
+#endif
+#ifdef MALLOC_ADAPTIVE_SPIN
+    int         budget;
+    int         tries;
+#endif
+
+    if (SINGLE_THREADED())
+    {
+        /* with locking compiled out, a thread is caught on its first lock */
+        lock_check_threads();
+        lock->elided = 1;
+        return;
+    }
+    if (pthread_mutex_trylock(&lock->mutex) == 0)
+    {
+#ifdef MALLOC_LOCK_STATS
+        lock->stats.acquisitions++;
+#endif
+        return;
+    }
+
+    TRACE_START(start);
+#ifdef MALLOC_LOCK_STATS
+    wait_start = now_ns();
+#endif
+#ifdef MALLOC_ADAPTIVE_SPIN
+    budget = __atomic_load_n(&lock->spin, __ATOMIC_RELAXED);
+    if (budget > spin_limit())
+        budget = spin_limit();
+    for (tries = 1; tries <= budget; tries++)
+    {
+# if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+# endif
+        if (pthread_mutex_trylock(&lock->mutex) == 0)
+            break;
+    }
+    if (tries > budget)
+        pthread_mutex_lock(&lock->mutex);
+    adapt_spin(lock, tries, tries > budget);
+#else
+    pthread_mutex_lock(&lock->mutex);
+#endif
+
+#ifdef MALLOC_LOCK_STATS
+# ifdef MALLOC_ADAPTIVE_SPIN
+    if (tries <= budget)
+        lock->stats.spin_acquired++;
+# endif
+    lock->stats.acquisitions++;
+    record_wait(&lock->stats, now_ns() - wait_start);
+#endif
+    TRACE_END(TRACE_LOCK_WAIT, 0, start);
+}
+
+
+/*
+ * release an allocator lock, the way it was taken: a thread that appeared
+ * in between must not make us unlock a mutex nobody locked
+ */
+void malloc_unlock(t_lock *lock)
+{
+    if (lock->elided)
+    {
+        lock->elided = 0;
+        return;
+    }
+    pthread_mutex_unlock(&lock->mutex);
+}
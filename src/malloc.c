@@ -11,14 +11,35 @@
 /* ************************************************************************** */
 
 #include "../inc/malloc.h"
+#include <errno.h>
 
 /* global state variable */
-t_malloc_state g_malloc_state = {NULL, NULL, NULL, PTHREAD_MUTEX_INITIALIZER};
+t_malloc_state g_malloc_state = {
+    .lock = LOCK_INITIALIZER,
+    .tiny_zones = NULL,
+    .small_zones = NULL,
+    .medium_zones = NULL,
+    .large_zones = NULL,
+    .large = {NULL, 0},
+    .reserve = {NULL, NULL},
+    .reserve_count = {0, 0},
+    .large_cache = NULL,
+    .reserved_large = 0,
+    .reserved = 0,
+    .ready = {NULL, NULL},
+    .ready_count = {0, 0},
+    .node = -1,
+    .next = NULL
+};
 
 
 /* initializing once flag */
 static pthread_once_t init_once = PTHREAD_ONCE_INIT;
 static int initialized = 0;
+static int atfork_registered = 0;
+
+/* set once both of the above are done; all malloc_init checks after that */
+static int ready = 0;
 
 
 // #ifdef DEBUG
@@ -72,110 +93,291 @@ static int initialized = 0;
 /* initialization function */
 static void init_malloc_state(void)
 {
-    pthread_mutex_init(&g_malloc_state.mutex, NULL);
+    if (initialized)
+        return;
+    lock_init(&g_malloc_state.lock);
     g_malloc_state.tiny_zones = NULL;
     g_malloc_state.small_zones = NULL;
+    g_malloc_state.medium_zones = NULL;
     g_malloc_state.large_zones = NULL;
+    bootstrap_zones(&g_malloc_state);
+    trace_init();
+    numa_init();
+    background_init();
+    pressure_init();
+    lifetime_init();
     initialized = 1;
 }
 
 
+/*
+ * make sure the global state is set up and the fork handlers are in place.
+ * pthread_atfork may itself allocate, so it is registered outside of
+ * pthread_once to let that nested malloc go through. the library
+ * constructor normally gets here first, leaving every later call a flag test.
+ * with a single thread there is nobody to race, and pthread_once would
+ * cost the constructor a futex wake
+ */
+void malloc_init(void)
+{
+    if (__builtin_expect(__atomic_load_n(&ready, __ATOMIC_ACQUIRE), 1))
+        return;
+
+    if (malloc_single_threaded())
+        init_malloc_state();
+    else
+        pthread_once(&init_once, init_malloc_state);
+
+    if (!atfork_registered && __sync_bool_compare_and_swap(&atfork_registered, 0, 1))
+    {
+        pthread_atfork(malloc_atfork_prepare, malloc_atfork_parent, malloc_atfork_child);
+        __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+/* initialize at load time rather than in the first malloc call */
+__attribute__((constructor))
+static void malloc_constructor(void)
+{
+    malloc_init();
+}
+
+
 
-/* Allocate large blocks directly */
-void *allocate_large(size_t size)
+/*
+ * map (or, for bounded-latency threads, reuse) a LARGE zone for one block;
+ * zero asks for zeroed memory, which a fresh mapping already is. hint is
+ * the block's realloc growth count, set before anyone can see the block
+ */
+static void *large_block(t_malloc_state *state, size_t size, bool zero, unsigned int hint)
 {
     t_zone      *zone;
     t_block     *block;
-    // t_footer    *footer;
 
-    // create a new zone just large enough for this allocation
-    zone = create_zone(LARGE, size);
+    // map a new zone just large enough for this allocation, no lock held;
+    // bounded-latency threads reuse a pre-faulted one instead
+    TRACE_START(start);
+    if (thread_reserve_only())
+        zone = large_cache_take(state, size);
+    else
+        zone = map_zone(LARGE, size, state->node);
     if (!zone)
         return NULL;
 
     // get the block from the zone
     block = zone->first;
+    if (zero)
+        zone_zero_block(zone, block);
+    zone_commit_block(zone, block);
 
     // mark block as allocated
     block->is_free = 0;
+    block->grow_hint = hint;
     zone->free_blocks--;
 
+    // publish it; only a full registry needs the lock
+    if (!large_register(state, zone))
+    {
+        malloc_lock(&state->lock);
+        zone->next = state->large_zones;
+        state->large_zones = zone;
+        malloc_unlock(&state->lock);
+    }
+    TRACE_END(TRACE_LARGE_ALLOC, size, start);
+
     // return pointer to user data
     return (PTR_FROM_BLOCK(block));
 }
 
 
-/* main malloc implementation */
-void *malloc(size_t size)
+/* Allocate large blocks directly, with a realloc growth hint */
+void *allocate_large(t_malloc_state *state, size_t size, unsigned int hint)
+{
+    return (large_block(state, size, false, hint));
+}
+
+
+/*
+ * allocate from the zone lists of the given state (global or heap),
+ * zeroing the parts of the block not already known to be zero if asked;
+ * TINY/SMALL blocks come from zones of the given lifetime class. hint is
+ * the realloc growth count the block starts with, set under the lock
+ */
+static void *alloc_block(t_malloc_state *state, size_t size, bool zero,
+    uint32_t lifetime, unsigned int hint)
 {
     t_zone      *zone;
     t_block     *block;
     t_zone_type zone_type;
-    // static int in_malloc= 0; // prevent recursive debug prints
-    // t_footer    *footer;
-    
-    /* ensuring initialization */
-    pthread_once(&init_once, init_malloc_state);
-
 
     if (size == 0)
         return NULL;
+    if (size > MAX_ALLOC_SIZE)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
 
     /* align size and add metadata overhead */
     size = BLOCK_SIZE(ALIGN(size));
 
-    // #ifdef DEBUG
-    // /* only print if we're not already in a malloc call (prevents recursion) */
-    // if (__sync_bool_compare_and_swap(&in_malloc, 0, 1)) {
-    //     debug_print_size(size);
-    //     __sync_bool_compare_and_swap(&in_malloc, 1, 0);
-    // }
-    // #endif
-
     /* determine zone based on size */
     if (size <= BLOCK_SIZE(TINY_MAX))
         zone_type = TINY;
     else if (size <= BLOCK_SIZE(SMALL_MAX))
         zone_type = SMALL;
+    else if (size <= BLOCK_SIZE(MEDIUM_MAX) && !thread_reserve_only())
+        return (medium_alloc(state, size, zero, hint));
     else
-    {
-        pthread_mutex_lock(&g_malloc_state.mutex);
-        void *result = allocate_large(size);
-        pthread_mutex_unlock(&g_malloc_state.mutex);
-        return result;
-    }
+        return (large_block(state, size, zero, hint));
 
     /* lock for thread safety */
-    pthread_mutex_lock(&g_malloc_state.mutex);
+    malloc_lock(&state->lock);
 
     /* try find a zone with enough space */
-    zone = find_zone_with_space(size, zone_type);
+    zone = find_zone_with_space(state, size, zone_type, lifetime);
 
     /* if no suitable zone found, create a new one */
     if (!zone)
     {
-        zone = create_zone(zone_type, size);
+        zone = create_zone(state, zone_type, size);
         if (!zone)
         {
-            pthread_mutex_unlock(&g_malloc_state.mutex);
+            malloc_unlock(&state->lock);
             return NULL;
         }
+        zone->lifetime = lifetime;
     }
 
     /* find a free block in the zone */
     block = find_free_block(zone, size);
 
-    /* split the block if needed */
-    block = split_block(block, size);
+    /* split the block if needed, zero it while the page bits still tell */
+    block = split_block(zone, block, size);
+    if (zero)
+        zone_zero_block(zone, block);
+    zone_commit_block(zone, block);
 
     /* mark block as allocated */
     block->is_free = 0;
+    block->grow_hint = hint;
     zone->free_blocks--;
 
     /* unlock */
-    pthread_mutex_unlock(&g_malloc_state.mutex);
+    malloc_unlock(&state->lock);
 
     /* return pointer to user data area */
     return (PTR_FROM_BLOCK(block));
 }
 
+
+/* allocate from the zone lists of the given state (global or heap) */
+void *state_malloc(t_malloc_state *state, size_t size)
+{
+    return (alloc_block(state, size, false, LIFETIME_DEFAULT, 0));
+}
+
+
+/*
+ * allocation from the given state, in zones of the given lifetime class,
+ * for a block realloc saw grow hint times
+ */
+void *state_malloc_lifetime(t_malloc_state *state, size_t size, uint32_t lifetime,
+    unsigned int hint)
+{
+    return (alloc_block(state, size, false, lifetime, hint));
+}
+
+
+/* zero-filled allocation from the given state */
+void *state_calloc(t_malloc_state *state, size_t size)
+{
+    return (alloc_block(state, size, true, LIFETIME_DEFAULT, 0));
+}
+
+
+#ifdef MALLOC_LIFETIME_FRAMES
+/*
+ * the call site of a malloc, as a hash of the return addresses of its
+ * first LIFETIME_SITE_FRAMES frames, so blocks reached through a shared
+ * wrapper are told apart by the wrapper's callers. follows saved frame
+ * pointers, stopping at the first one that does not lead a little way up
+ * the stack; callers built without frame pointers just end the walk early
+ */
+static inline __attribute__((always_inline)) void *call_site(void)
+{
+    void        **frame;
+    void        **next;
+    uintptr_t   site;
+    int         depth;
+
+    frame = __builtin_frame_address(0);
+    site = 0;
+    for (depth = 0; depth < LIFETIME_SITE_FRAMES; depth++)
+    {
+        site = (site ^ (uintptr_t)frame[1]) * 0x100000001B3ULL;
+        next = frame[0];
+        if (next <= frame || (char *)next - (char *)frame > LIFETIME_FRAME_SPAN ||
+            ((uintptr_t)next & (sizeof(void *) - 1)))
+            break;
+        frame = next;
+    }
+    return ((void *)(site | 1));
+}
+#else
+/* the call site of a malloc: its return address only, see LIFETIME_SITE_FRAMES */
+# define call_site() __builtin_return_address(0)
+#endif
+
+
+/* main malloc implementation */
+void *malloc(size_t size)
+{
+    void    *ptr;
+    void    *site;
+
+    /* ensuring initialization */
+    malloc_init();
+
+    /* small blocks may be hinted by what their call site's blocks did */
+    if (size <= SMALL_MAX && lifetime_predicting())
+    {
+        site = call_site();
+        ptr = alloc_block(numa_arena(), size, false, lifetime_predict(site), 0);
+        lifetime_sample(ptr, site);
+    }
+    else
+        ptr = state_malloc(numa_arena(), size);
+
+    /* no lock is held here, the background thread may be started */
+    background_spawn();
+    pressure_check();
+    return (ptr);
+}
+
+
+/*
+ * malloc with a lifetime hint: MALLOC_HINT_SHORT_LIVED or
+ * MALLOC_HINT_LONG_LIVED keep the block away from zones holding the other
+ * kind; anything else is a plain malloc
+ */
+void *malloc_hinted(size_t size, int hints)
+{
+    void        *ptr;
+    uint32_t    lifetime;
+
+    malloc_init();
+
+    if (hints == MALLOC_HINT_SHORT_LIVED)
+        lifetime = LIFETIME_SHORT;
+    else if (hints == MALLOC_HINT_LONG_LIVED)
+        lifetime = LIFETIME_LONG;
+    else
+        lifetime = LIFETIME_DEFAULT;
+    ptr = alloc_block(numa_arena(), size, false, lifetime, 0);
+
+    background_spawn();
+    pressure_check();
+    return (ptr);
+}
@@ -0,0 +1,348 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   medium.c                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/*
+ * MEDIUM class.
+ *
+ * Requests above SMALL_MAX and up to MEDIUM_MAX are rounded up to whole
+ * pages and carved as runs out of MEDIUM_ZONE chunks shared by all of
+ * them, with the usual block headers and boundary tags. Free runs are kept
+ * in the state's bins by page count, so an allocation never walks the
+ * chunks, and free coalesces neighbours before binning the result.
+ *
+ * A binned run is linked forward through block->next and back through the
+ * first word of its payload, which a free run does not use, so any run
+ * leaves its bin in constant time. The generic block helpers absorb free
+ * neighbours and create new free blocks without knowing about bins, so the
+ * free neighbours of a run are taken out of their bins before it is split,
+ * merged or resized, and put back after.
+ * Slack shorter than a page (the end of a chunk) is never binned since no
+ * MEDIUM request fits it.
+ *
+ * The chunk of a pointer comes from the chunk map, which holds the chunk
+ * and its state for every MEDIUM_MAP_GRANULE of it: written under the state
+ * lock when the chunk is mapped, cleared under it before it is unmapped.
+ * An entry of another state is never followed, so a pointer handed to the
+ * wrong state is rejected like any invalid pointer.
+ */
+
+#define RUN_PREV(block) (*(t_block **)PTR_FROM_BLOCK(block))
+
+#define MAP_ROOT_SLOTS (1UL << (MEDIUM_MAP_ADDR_BITS - MEDIUM_MAP_SHIFT - MEDIUM_MAP_LEAF_BITS))
+#define MAP_LEAF_SLOTS (1UL << MEDIUM_MAP_LEAF_BITS)
+
+typedef struct s_map_entry {
+    t_zone          *chunk;
+    t_malloc_state  *state;
+} t_map_entry;
+
+static t_map_entry  **g_map_root;   // MAP_ROOT_SLOTS leaves
+
+
+/* block size of a MEDIUM allocation: whole pages */
+size_t medium_run_size(size_t size)
+{
+    return (ROUND_UP(size, (size_t)getpagesize()));
+}
+
+
+/* bin of a free run, -1 for sub-page slack */
+static int bin_index(size_t size)
+{
+    size_t  pages;
+
+    pages = size / getpagesize();
+    if (pages == 0)
+        return -1;
+    if (pages > MEDIUM_BINS)
+        pages = MEDIUM_BINS;
+    return ((int)pages - 1);
+}
+
+
+static void bin_insert(t_malloc_state *state, t_zone *zone, t_block *block)
+{
+    size_t  end;
+    int     bin;
+
+    bin = bin_index(block->size);
+    block->next = NULL;
+    if (bin < 0)
+        return;
+
+    /* the back link is written memory calloc must not take for zero */
+    end = (char *)PTR_FROM_BLOCK(block) + sizeof(t_block *) - (char *)zone;
+    if (end > zone->dirty)
+        zone->dirty = end;
+
+    RUN_PREV(block) = NULL;
+    block->next = state->medium_bins[bin];
+    if (block->next)
+        RUN_PREV(block->next) = block;
+    state->medium_bins[bin] = block;
+}
+
+
+/* take a free run out of its bin */
+void medium_unbin(t_malloc_state *state, t_block *block)
+{
+    t_block *prev;
+    int     bin;
+
+    bin = bin_index(block->size);
+    if (bin < 0)
+        return;
+    prev = RUN_PREV(block);
+    if (prev)
+        prev->next = block->next;
+    else
+        state->medium_bins[bin] = block->next;
+    if (block->next)
+        RUN_PREV(block->next) = prev;
+    block->next = NULL;
+}
+
+
+/*
+ * unbin the smallest run of at least size bytes; every run of a bin below
+ * the last one fits, the last one is searched
+ */
+static t_block *bin_take(t_malloc_state *state, size_t size)
+{
+    t_block *block;
+    int     bin;
+
+    for (bin = bin_index(size); bin < MEDIUM_BINS; bin++)
+    {
+        for (block = state->medium_bins[bin]; block; block = block->next)
+        {
+            if (block->size >= size)
+            {
+                medium_unbin(state, block);
+                return block;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/* table stored at slot, mapped on first use if asked */
+static void *map_table(void **slot, size_t bytes, bool create)
+{
+    void    *table;
+    void    *seen;
+
+    table = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (table || !create)
+        return table;
+
+    table = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED)
+        return NULL;
+
+    /* another thread may have won the race */
+    seen = NULL;
+    if (!__atomic_compare_exchange_n(slot, &seen, table, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        munmap(table, bytes);
+        table = seen;
+    }
+    return table;
+}
+
+
+/* chunk map entry of addr, its tables mapped on first use if asked */
+static t_map_entry *map_slot(uintptr_t addr, bool create)
+{
+    t_map_entry **root;
+    t_map_entry *leaf;
+
+    if (addr >> MEDIUM_MAP_ADDR_BITS)
+        return NULL;
+    root = map_table((void **)&g_map_root, MAP_ROOT_SLOTS * sizeof(t_map_entry *), create);
+    if (!root)
+        return NULL;
+    leaf = map_table((void **)&root[addr >> (MEDIUM_MAP_SHIFT + MEDIUM_MAP_LEAF_BITS)],
+        MAP_LEAF_SLOTS * sizeof(t_map_entry), create);
+    if (!leaf)
+        return NULL;
+    return (&leaf[(addr >> MEDIUM_MAP_SHIFT) & (MAP_LEAF_SLOTS - 1)]);
+}
+
+
+/* record (or with NULL, forget) the state of every granule of a chunk */
+static bool map_chunk(t_zone *zone, t_malloc_state *state)
+{
+    uintptr_t   addr;
+    t_map_entry *entry;
+
+    for (addr = (uintptr_t)zone; addr < (uintptr_t)zone + zone->zone_size;
+        addr += MEDIUM_MAP_GRANULE)
+    {
+        entry = map_slot(addr, state != NULL);
+        if (!entry && state)
+            return false;
+        if (!entry)
+            continue;
+        __atomic_store_n(&entry->chunk, state ? zone : NULL, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->state, state, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+
+/* a chunk is about to be unmapped: drop it from the map. its state lock held */
+void medium_forget(t_zone *zone)
+{
+    map_chunk(zone, NULL);
+}
+
+
+/* chunk of state holding addr, NULL if there is none */
+static t_zone *chunk_of(t_malloc_state *state, void *addr)
+{
+    t_map_entry *entry;
+
+    entry = map_slot((uintptr_t)addr, false);
+    if (!entry || __atomic_load_n(&entry->state, __ATOMIC_RELAXED) != state)
+        return NULL;
+    return (__atomic_load_n(&entry->chunk, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * find the MEDIUM chunk and run of ptr, NULL if ptr is not the start of a
+ * run of state; only the runs of that one chunk are walked. state lock held
+ */
+t_zone *medium_find(t_malloc_state *state, void *ptr, t_block **block_ptr)
+{
+    t_zone  *zone;
+    t_block *block;
+
+    zone = chunk_of(state, ptr);
+    if (!zone)
+        return NULL;
+    for (block = zone->first; block && (void *)block < ptr; block = next_in_zone(zone, block))
+    {
+        if (PTR_FROM_BLOCK(block) == ptr)
+        {
+            *block_ptr = block;
+            return zone;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * allocate a MEDIUM run for a block of size bytes (headers included),
+ * zeroed if asked, starting with the realloc growth count hint
+ */
+void *medium_alloc(t_malloc_state *state, size_t size, bool zero, unsigned int hint)
+{
+    t_zone  *zone;
+    t_block *block;
+    t_block *rest;
+
+    size = medium_run_size(size);
+    malloc_lock(&state->lock);
+
+    /* a binned run, or a fresh chunk when there is none */
+    block = bin_take(state, size);
+    if (block)
+        zone = chunk_of(state, block);
+    else
+    {
+        zone = create_zone(state, MEDIUM, size);
+        if (zone && !map_chunk(zone, state))
+        {
+            state->medium_zones = zone->next;
+            medium_forget(zone);
+            munmap(zone, zone->zone_size);
+            zone = NULL;
+        }
+        if (!zone)
+        {
+            malloc_unlock(&state->lock);
+            return NULL;
+        }
+        block = zone->first;
+    }
+
+    /* keep what is left over */
+    block = split_block(zone, block, size);
+    rest = next_in_zone(zone, block);
+    if (rest && rest->is_free)
+        bin_insert(state, zone, rest);
+
+    if (zero)
+        zone_zero_block(zone, block);
+    zone_commit_block(zone, block);
+
+    block->is_free = 0;
+    block->grow_hint = hint;
+    zone->free_blocks--;
+
+    malloc_unlock(&state->lock);
+    return (PTR_FROM_BLOCK(block));
+}
+
+
+/*
+ * a run was just marked free: coalesce it with its free neighbours and bin
+ * the result, which is returned. state lock held
+ */
+t_block *medium_free(t_malloc_state *state, t_zone *zone, t_block *block)
+{
+    medium_resize_begin(state, zone, block);
+    block = merge_free_blocks(zone, block);
+    bin_insert(state, zone, block);
+    return block;
+}
+
+
+/*
+ * an allocated run is about to be split or grown in place: its free
+ * neighbours leave their bins. state lock held
+ */
+void medium_resize_begin(t_malloc_state *state, t_zone *zone, t_block *block)
+{
+    t_block *neighbour;
+
+    neighbour = next_in_zone(zone, block);
+    if (neighbour && neighbour->is_free)
+        medium_unbin(state, neighbour);
+    neighbour = prev_in_zone(zone, block);
+    if (neighbour && neighbour->is_free)
+        medium_unbin(state, neighbour);
+}
+
+
+/*
+ * the resize is done (block is where the run ended up): whatever is free
+ * around it goes back into the bins. state lock held
+ */
+void medium_resize_end(t_malloc_state *state, t_zone *zone, t_block *block)
+{
+    t_block *neighbour;
+
+    neighbour = next_in_zone(zone, block);
+    if (neighbour && neighbour->is_free)
+        bin_insert(state, zone, neighbour);
+    neighbour = prev_in_zone(zone, block);
+    if (neighbour && neighbour->is_free)
+        bin_insert(state, zone, neighbour);
+}
@@ -0,0 +1,408 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   numa.c                                             :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+#include <sys/syscall.h>
+
+extern t_malloc_state g_malloc_state;
+
+/*
+ * NUMA placement.
+ *
+ * On a machine with more than one memory node every node gets its own arena
+ * (node 0 is the global state, the others are created on first use) and
+ * every zone an arena maps is mbind'ed to that arena's node before it is
+ * touched. malloc goes to the arena of the node the thread is running on;
+ * free and realloc go to the arena that owns the pointer.
+ *
+ * Only the raw syscalls are used (no libnuma). With a single node, or with
+ * FT_MALLOC_NUMA=0, everything stays on the global state and none of this
+ * costs more than one branch. FT_MALLOC_NUMA_NODES=n overrides the number
+ * of arenas, which lets the multi-arena paths run on a one-node machine
+ * (binds to nodes that do not exist simply fail and are counted). The
+ * kernel is first asked when a zone is mapped, not at load time: the
+ * bootstrap zones serve a short-lived process without a single syscall.
+ *
+ * The owner of a pointer comes from the owner map: a byte per
+ * OWNER_GRANULE holding the node of the zone there, written by map_zone
+ * for every zone (only the first granule of a LARGE one, which is where
+ * its block starts). Bytes left by unmapped zones are not cleared; the
+ * next zone mapped there overwrites them, and a stray pointer sent to the
+ * wrong arena is rejected by it like any invalid pointer.
+ */
+
+/* from <numaif.h>, which is part of libnuma */
+#define MPOL_PREFERRED 1
+#define MPOL_F_NODE (1 << 0)
+#define MPOL_F_ADDR (1 << 1)
+#define MPOL_F_MEMS_ALLOWED (1 << 2)
+
+/* re-read the current node every this many allocations */
+#define NODE_REFRESH 256
+
+#define OWNER_ROOT_SLOTS (1UL << (OWNER_ADDR_BITS - OWNER_SHIFT - OWNER_LEAF_BITS))
+#define OWNER_LEAF_BYTES (1UL << OWNER_LEAF_BITS)
+
+static t_malloc_state   *g_arenas[NUMA_MAX_NODES];
+static uint8_t          **g_owner_root;     // OWNER_ROOT_SLOTS leaves
+static int              g_nodes = 1;
+static int              g_wanted = -1;      // FT_MALLOC_NUMA_NODES, -1 = ask the kernel
+static int              g_resolved = 0;     // numa_resolve has run
+static size_t           g_bound[NUMA_MAX_NODES];
+static size_t           g_bind_failed[NUMA_MAX_NODES];
+
+static __thread int         t_pinned = -1;
+static __thread int         t_node;
+static __thread unsigned    t_node_age;
+
+
+/* parse a small decimal environment value, -1 if unset */
+static int env_number(const char *name)
+{
+    const char  *value;
+    int         number;
+
+    value = getenv(name);
+    if (!value || *value < '0' || *value > '9')
+        return -1;
+    number = 0;
+    while (*value >= '0' && *value <= '9')
+        number = number * 10 + (*value++ - '0');
+    return number;
+}
+
+
+/* number of memory nodes this process may use, 1 on error */
+static int allowed_nodes(void)
+{
+    unsigned long   mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+    int             nodes;
+    int             node;
+
+    for (node = 0; node < (int)(sizeof(mask) / sizeof(mask[0])); node++)
+        mask[node] = 0;
+    if (syscall(SYS_get_mempolicy, NULL, mask, sizeof(mask) * 8, NULL,
+            MPOL_F_MEMS_ALLOWED) != 0)
+        return 1;
+
+    /* arenas are indexed by node id, so count up to the highest one */
+    nodes = 1;
+    for (node = 0; node < NUMA_MAX_NODES; node++)
+    {
+        if (mask[node / (8 * sizeof(unsigned long))] & (1UL << (node % (8 * sizeof(unsigned long)))))
+            nodes = node + 1;
+    }
+    return nodes;
+}
+
+
+/*
+ * read FT_MALLOC_NUMA and FT_MALLOC_NUMA_NODES, called once from malloc
+ * initialization. nothing is asked of the kernel here: that waits for
+ * numa_resolve
+ */
+void numa_init(void)
+{
+    g_arenas[0] = &g_malloc_state;
+    if (env_number("FT_MALLOC_NUMA") == 0)
+        g_wanted = 1;
+    else
+        g_wanted = env_number("FT_MALLOC_NUMA_NODES");
+}
+
+
+/* count the nodes and map the owner map; the first caller does it */
+static void numa_setup(void)
+{
+    int nodes;
+
+    nodes = g_wanted;
+    if (nodes < 0)
+        nodes = allowed_nodes();
+    if (nodes > NUMA_MAX_NODES)
+        nodes = NUMA_MAX_NODES;
+    if (nodes <= 1)
+        return;
+
+    /* no owner map, no arenas */
+    g_owner_root = mmap(NULL, OWNER_ROOT_SLOTS * sizeof(uint8_t *),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (g_owner_root == MAP_FAILED)
+    {
+        g_owner_root = NULL;
+        return;
+    }
+    g_malloc_state.node = 0;
+    __atomic_store_n(&g_nodes, nodes, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * decide how many arenas to run, on the first zone mapped or NUMA call.
+ * until then everything is on the global state, which is node 0's arena,
+ * so the zones already handed out need no owner entries. a thread that
+ * arrives while another is deciding carries on with the single arena
+ */
+void numa_resolve(void)
+{
+    if (__atomic_load_n(&g_resolved, __ATOMIC_ACQUIRE))
+        return;
+    if (__sync_bool_compare_and_swap(&g_resolved, 0, 1))
+        numa_setup();
+}
+
+
+/* owner map leaf covering addr, mapped on first use if asked */
+static uint8_t *owner_leaf(uintptr_t addr, bool create)
+{
+    uint8_t **slot;
+    uint8_t *leaf;
+    uint8_t *seen;
+
+    if (addr >> OWNER_ADDR_BITS)
+        return NULL;
+    slot = &g_owner_root[addr >> (OWNER_SHIFT + OWNER_LEAF_BITS)];
+    leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (leaf || !create)
+        return leaf;
+
+    leaf = mmap(NULL, OWNER_LEAF_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (leaf == MAP_FAILED)
+        return NULL;
+
+    /* another thread may have won the race */
+    seen = NULL;
+    if (!__atomic_compare_exchange_n(slot, &seen, leaf, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        munmap(leaf, OWNER_LEAF_BYTES);
+        leaf = seen;
+    }
+    return leaf;
+}
+
+
+/*
+ * record node (-1 counts as the global state's) as the owner of
+ * [addr, addr + size); false if the map could not take it, in which case
+ * the zone must not be used. nothing to do with a single arena
+ */
+bool numa_mark(void *addr, size_t size, int node)
+{
+    uintptr_t   granule;
+    uintptr_t   end;
+    uint8_t     *leaf;
+
+    if (__atomic_load_n(&g_nodes, __ATOMIC_ACQUIRE) <= 1)
+        return true;
+    granule = (uintptr_t)addr >> OWNER_SHIFT;
+    end = ((uintptr_t)addr + size - 1) >> OWNER_SHIFT;
+    for (; granule <= end; granule++)
+    {
+        leaf = owner_leaf(granule << OWNER_SHIFT, true);
+        if (!leaf)
+            return false;
+        __atomic_store_n(&leaf[granule & (OWNER_LEAF_BYTES - 1)],
+            (uint8_t)(node < 0 ? 0 : node), __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+
+/*
+ * prefer node for a fresh, untouched mapping. the mapping stays usable if
+ * the kernel refuses; either way the outcome is counted for the stats
+ */
+void numa_bind(void *addr, size_t size, int node)
+{
+    unsigned long   mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+    size_t          i;
+
+    if (node < 0)
+        return;
+    for (i = 0; i < sizeof(mask) / sizeof(mask[0]); i++)
+        mask[i] = 0;
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+    if (syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0) == 0)
+        __sync_fetch_and_add(&g_bound[node], 1);
+    else
+        __sync_fetch_and_add(&g_bind_failed[node], 1);
+}
+
+
+/* node the calling thread runs on, cached for NODE_REFRESH calls */
+static int current_node(void)
+{
+    unsigned    cpu;
+    unsigned    node;
+
+    if (t_pinned >= 0)
+        return t_pinned;
+    if (t_node_age++ % NODE_REFRESH == 0)
+    {
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+            node = 0;
+        t_node = (int)node % g_nodes;
+    }
+    return t_node;
+}
+
+
+/* arena of a node, created on first use */
+static t_malloc_state *arena_for_node(int node)
+{
+    t_malloc_state  *arena;
+
+    arena = __atomic_load_n(&g_arenas[node], __ATOMIC_ACQUIRE);
+    if (arena)
+        return arena;
+
+    arena = heap_create();
+    if (!arena)
+        return &g_malloc_state;
+    arena->node = node;
+
+    /* another thread may have won the race */
+    if (!__sync_bool_compare_and_swap(&g_arenas[node], NULL, arena))
+    {
+        heap_destroy(arena);
+        arena = __atomic_load_n(&g_arenas[node], __ATOMIC_ACQUIRE);
+    }
+    return arena;
+}
+
+
+/*
+ * arena new allocations of the calling thread come from. bounded-latency
+ * threads stay on the global state, where malloc_reserve puts its zones
+ */
+t_malloc_state *numa_arena(void)
+{
+    if (g_nodes <= 1 || thread_reserve_only())
+        return &g_malloc_state;
+    return arena_for_node(current_node());
+}
+
+
+/* arena of a node if it exists yet, NULL otherwise */
+t_malloc_state *numa_arena_at(int node)
+{
+    if (node < 0 || node >= g_nodes)
+        return NULL;
+    return (__atomic_load_n(&g_arenas[node], __ATOMIC_ACQUIRE));
+}
+
+
+/*
+ * arena that owns ptr, read from the owner map; the global state when
+ * there is only one, or when the map knows nothing of the pointer (so
+ * invalid pointers are rejected as before)
+ */
+t_malloc_state *numa_owner(void *ptr)
+{
+    t_malloc_state  *arena;
+    uint8_t         *leaf;
+
+    if (__atomic_load_n(&g_nodes, __ATOMIC_ACQUIRE) <= 1 || !ptr)
+        return &g_malloc_state;
+    leaf = owner_leaf((uintptr_t)ptr, false);
+    if (!leaf)
+        return &g_malloc_state;
+    arena = numa_arena_at(__atomic_load_n(
+        &leaf[((uintptr_t)ptr >> OWNER_SHIFT) & (OWNER_LEAF_BYTES - 1)], __ATOMIC_RELAXED));
+    return (arena ? arena : &g_malloc_state);
+}
+
+
+/*
+ * pin the calling thread to the arena of node, or -1 to follow the cpu
+ * again. returns -1 if node is out of range
+ */
+int malloc_numa_bind_thread(int node)
+{
+    malloc_init();
+    numa_resolve();
+    if (node >= g_nodes)
+        return -1;
+    t_pinned = node < 0 ? -1 : node;
+    t_node_age = 0;
+    return 0;
+}
+
+
+/* count a zone as local or remote by the node its header page is on */
+static void count_zone(t_zone *zone, int node, t_numa_stats *stats)
+{
+    int actual;
+
+    actual = -1;
+    if (syscall(SYS_get_mempolicy, &actual, NULL, 0, zone,
+            MPOL_F_NODE | MPOL_F_ADDR) != 0 || actual != node)
+        stats->zones_remote[node]++;
+    else
+        stats->zones_local[node]++;
+}
+
+
+/* placement of every zone of an arena, registered LARGE ones included */
+static void arena_placement(t_malloc_state *arena, int node, t_numa_stats *stats)
+{
+    t_zone  *lists[4];
+    t_zone  *zone;
+    size_t  cursor;
+    int     i;
+
+    malloc_lock(&arena->lock);
+    lists[0] = arena->tiny_zones;
+    lists[1] = arena->small_zones;
+    lists[2] = arena->medium_zones;
+    lists[3] = arena->large_zones;
+    for (i = 0; i < 4; i++)
+    {
+        for (zone = lists[i]; zone; zone = zone->next)
+            count_zone(zone, node, stats);
+    }
+
+    large_walk_begin(arena);
+    cursor = 0;
+    while ((zone = large_next(arena, &cursor)))
+        count_zone(zone, node, stats);
+    large_walk_end(arena);
+    malloc_unlock(&arena->lock);
+}
+
+
+/*
+ * fill stats with the arena count, bind outcomes and where the zones of
+ * each arena actually ended up
+ */
+int malloc_numa_stats(t_numa_stats *stats)
+{
+    t_malloc_state  *arena;
+    int             node;
+
+    malloc_init();
+    numa_resolve();
+    ft_bzero(stats, sizeof(*stats));
+
+    stats->nodes = g_nodes;
+    for (node = 0; node < g_nodes; node++)
+    {
+        stats->zones_bound[node] = __atomic_load_n(&g_bound[node], __ATOMIC_RELAXED);
+        stats->bind_failed[node] = __atomic_load_n(&g_bind_failed[node], __ATOMIC_RELAXED);
+        arena = numa_arena_at(node);
+        if (arena)
+            arena_placement(arena, node, stats);
+    }
+    return 0;
+}
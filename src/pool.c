@@ -0,0 +1,512 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   pool.c                                             :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+/*
+ * Fixed-size object pools.
+ *
+ * A pool hands out objects of a single size from zones of its own. There
+ * is no block header, no size class dispatch and no first-fit search:
+ * pool_alloc pops the most recently freed object off a list linked through
+ * the objects themselves, or carves the next never used one off the newest
+ * zone. Zones are only given back by pool_destroy.
+ *
+ * With POOL_MAGAZINES every thread also keeps a magazine of up to
+ * POOL_MAGAZINE_SIZE objects per pool (for POOL_MAGAZINE_SLOTS pools at a
+ * time), so most calls take no lock. Magazines are refilled and flushed
+ * half at a time, and flushed when the thread exits. A magazine left over
+ * from a destroyed pool is recognized by the pool id and dropped. The
+ * magazines of every thread are registered so malloc_analyze can tell the
+ * objects they hold from those handed out.
+ */
+
+typedef struct s_magazine {
+    t_pool      *pool;      // owner, only trusted together with id
+    uint64_t    id;
+    size_t      count;
+    void        *objects[POOL_MAGAZINE_SIZE];
+} t_magazine;
+
+typedef struct s_magazine_set {
+    t_magazine              magazines[POOL_MAGAZINE_SLOTS];
+    struct s_magazine_set   *next;  // registered sets, under g_pools_mutex
+    struct s_magazine_set   *prev;
+} t_magazine_set;
+
+/* registry of live pools, walked by the fork handlers and show_alloc_mem */
+static t_pool           *g_pools = NULL;
+static pthread_mutex_t  g_pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t         g_next_id = 1;
+static t_magazine_set   *g_magazine_sets = NULL;
+
+/* flushes the magazines of an exiting thread */
+static pthread_key_t    g_magazine_key;
+static pthread_once_t   g_magazine_once = PTHREAD_ONCE_INIT;
+
+static __thread t_magazine_set  t_set;
+static __thread int             t_magazine_registered = 0;
+
+
+/* map a new zone for the pool and make it the one objects are carved from */
+static t_pool_zone *pool_zone_create(t_pool *pool)
+{
+    t_pool_zone *zone;
+    size_t      header;
+    size_t      size;
+
+    header = ROUND_UP(sizeof(t_pool_zone), pool->align);
+    size = ROUND_UP(header + pool->obj_size * POOL_ZONE_OBJECTS, (size_t)getpagesize());
+    if (size < POOL_ZONE_MIN)
+        size = POOL_ZONE_MIN;
+
+    zone = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (zone == MAP_FAILED)
+        return NULL;
+    numa_bind(zone, size, pool->node);
+
+    zone->zone_size = size;
+    zone->first = (char *)zone + header;
+    zone->bump = zone->first;
+    zone->end = zone->first + (size - header) / pool->obj_size * pool->obj_size;
+    zone->next = pool->zones;
+    pool->zones = zone;
+    pool->zone_count++;
+    pool->mapped_bytes += size;
+    return zone;
+}
+
+
+/* pop an object off the shared list, or carve a new one; pool lock held */
+static void *shared_take(t_pool *pool)
+{
+    t_pool_zone *zone;
+    void        *obj;
+
+    obj = pool->free_list;
+    if (obj)
+        pool->free_list = *(void **)obj;
+    else
+    {
+        zone = pool->zones;
+        if (!zone || zone->bump == zone->end)
+            zone = pool_zone_create(pool);
+        if (!zone)
+            return NULL;
+        obj = zone->bump;
+        zone->bump += pool->obj_size;
+    }
+    pool->in_use++;
+    return obj;
+}
+
+
+/* push an object onto the shared list; pool lock held */
+static void shared_put(t_pool *pool, void *obj)
+{
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->in_use--;
+}
+
+
+/*
+ * give every object of a magazine back to its pool, if that pool still
+ * exists; the registry lock keeps pool_destroy out meanwhile
+ */
+static void magazine_flush(t_magazine *magazine)
+{
+    t_pool  *pool;
+
+    if (magazine->count)
+    {
+        pthread_mutex_lock(&g_pools_mutex);
+        pool = g_pools;
+        while (pool && !(pool == magazine->pool && pool->id == magazine->id))
+            pool = pool->next;
+        if (pool)
+        {
+            malloc_lock(&pool->lock);
+            while (magazine->count)
+                shared_put(pool, magazine->objects[--magazine->count]);
+            pool->flushes++;
+            malloc_unlock(&pool->lock);
+        }
+        pthread_mutex_unlock(&g_pools_mutex);
+    }
+    magazine->pool = NULL;
+    magazine->id = 0;
+    magazine->count = 0;
+}
+
+
+/* thread exit: hand back everything the thread's magazines hold */
+static void magazine_thread_exit(void *unused)
+{
+    int i;
+
+    (void)unused;
+    for (i = 0; i < POOL_MAGAZINE_SLOTS; i++)
+        magazine_flush(&t_set.magazines[i]);
+
+    pthread_mutex_lock(&g_pools_mutex);
+    if (t_set.prev)
+        t_set.prev->next = t_set.next;
+    else
+        g_magazine_sets = t_set.next;
+    if (t_set.next)
+        t_set.next->prev = t_set.prev;
+    pthread_mutex_unlock(&g_pools_mutex);
+    t_magazine_registered = 0;
+}
+
+
+static void magazine_key_create(void)
+{
+    pthread_key_create(&g_magazine_key, magazine_thread_exit);
+}
+
+
+/* this thread's magazine for the pool, taking the slot over if needed */
+static t_magazine *magazine_for(t_pool *pool)
+{
+    t_magazine  *magazine;
+
+    magazine = &t_set.magazines[pool->id % POOL_MAGAZINE_SLOTS];
+    if (magazine->pool == pool && magazine->id == pool->id)
+        return magazine;
+
+    magazine_flush(magazine);
+    magazine->pool = pool;
+    magazine->id = pool->id;
+    if (!t_magazine_registered)
+    {
+        pthread_setspecific(g_magazine_key, (void *)1);
+        pthread_mutex_lock(&g_pools_mutex);
+        t_set.prev = NULL;
+        t_set.next = g_magazine_sets;
+        if (g_magazine_sets)
+            g_magazine_sets->prev = &t_set;
+        g_magazine_sets = &t_set;
+        pthread_mutex_unlock(&g_pools_mutex);
+        t_magazine_registered = 1;
+    }
+    return magazine;
+}
+
+
+/*
+ * create a pool of obj_size byte objects aligned on align (a power of two
+ * up to a page, 0 for the malloc alignment). flags may contain
+ * POOL_MAGAZINES. returns NULL on bad arguments or when out of memory
+ */
+t_pool *pool_create_flags(size_t obj_size, size_t align, int flags)
+{
+    t_pool  *pool;
+
+    if (!align)
+        align = ALIGNMENT;
+    if ((align & (align - 1)) || align > (size_t)getpagesize() || !obj_size ||
+        obj_size > (size_t)getpagesize() * 16)
+        return NULL;
+
+    malloc_init();
+    if (flags & POOL_MAGAZINES)
+        pthread_once(&g_magazine_once, magazine_key_create);
+
+    /* the pool header lives in its own mapping, like a heap's */
+    pool = mmap(NULL, sizeof(t_pool), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED)
+        return NULL;
+    if (lock_init(&pool->lock) != 0)
+    {
+        munmap(pool, sizeof(t_pool));
+        return NULL;
+    }
+    pool->free_list = NULL;
+    pool->zones = NULL;
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    pool->obj_size = ROUND_UP(obj_size, align);
+    pool->align = align;
+    pool->flags = flags;
+    pool->node = numa_arena()->node;
+    pool->zone_count = 0;
+    pool->mapped_bytes = 0;
+    pool->in_use = 0;
+    pool->refills = 0;
+    pool->flushes = 0;
+
+    pthread_mutex_lock(&g_pools_mutex);
+    pool->id = g_next_id++;
+    pool->next = g_pools;
+    g_pools = pool;
+    pthread_mutex_unlock(&g_pools_mutex);
+    return pool;
+}
+
+
+/* create a pool without magazines */
+t_pool *pool_create(size_t obj_size, size_t align)
+{
+    return (pool_create_flags(obj_size, align, 0));
+}
+
+
+/* one object of the pool, NULL when out of memory */
+void *pool_alloc(t_pool *pool)
+{
+    t_magazine  *magazine;
+    void        *obj;
+
+    if (!pool)
+        return NULL;
+
+    if (pool->flags & POOL_MAGAZINES)
+    {
+        magazine = magazine_for(pool);
+        if (!magazine->count)
+        {
+            malloc_lock(&pool->lock);
+            while (magazine->count < POOL_MAGAZINE_SIZE / 2 &&
+                (obj = shared_take(pool)))
+                magazine->objects[magazine->count++] = obj;
+            pool->refills++;
+            malloc_unlock(&pool->lock);
+        }
+        return (magazine->count ? magazine->objects[--magazine->count] : NULL);
+    }
+
+    malloc_lock(&pool->lock);
+    obj = shared_take(pool);
+    malloc_unlock(&pool->lock);
+    return obj;
+}
+
+
+/* give an object back to the pool it came from */
+void pool_free(t_pool *pool, void *ptr)
+{
+    t_magazine  *magazine;
+
+    if (!pool || !ptr)
+        return;
+
+    if (pool->flags & POOL_MAGAZINES)
+    {
+        magazine = magazine_for(pool);
+        if (magazine->count == POOL_MAGAZINE_SIZE)
+        {
+            malloc_lock(&pool->lock);
+            while (magazine->count > POOL_MAGAZINE_SIZE / 2)
+                shared_put(pool, magazine->objects[--magazine->count]);
+            pool->flushes++;
+            malloc_unlock(&pool->lock);
+        }
+        magazine->objects[magazine->count++] = ptr;
+        return;
+    }
+
+    malloc_lock(&pool->lock);
+    shared_put(pool, ptr);
+    malloc_unlock(&pool->lock);
+}
+
+
+/*
+ * release every zone of the pool and the pool itself; its objects,
+ * including those still in magazines, are invalid afterwards
+ */
+void pool_destroy(t_pool *pool)
+{
+    t_pool      **link;
+    t_pool_zone *zone;
+    t_pool_zone *next;
+
+    if (!pool)
+        return;
+
+    /* unregister first so neither fork nor a magazine flush sees it */
+    pthread_mutex_lock(&g_pools_mutex);
+    link = &g_pools;
+    while (*link && *link != pool)
+        link = &(*link)->next;
+    if (*link)
+        *link = pool->next;
+    pthread_mutex_unlock(&g_pools_mutex);
+
+    /* this thread's magazine is dropped right away */
+    if (t_set.magazines[pool->id % POOL_MAGAZINE_SLOTS].pool == pool)
+    {
+        t_set.magazines[pool->id % POOL_MAGAZINE_SLOTS].count = 0;
+        t_set.magazines[pool->id % POOL_MAGAZINE_SLOTS].pool = NULL;
+    }
+
+    zone = pool->zones;
+    while (zone)
+    {
+        next = zone->next;
+        munmap(zone, zone->zone_size);
+        zone = next;
+    }
+    lock_destroy(&pool->lock);
+    munmap(pool, sizeof(t_pool));
+}
+
+
+/* copy the counters of a pool */
+int pool_stats(t_pool *pool, t_pool_stats *stats)
+{
+    t_pool_zone *zone;
+
+    if (!pool)
+        return -1;
+    malloc_lock(&pool->lock);
+    stats->obj_size = pool->obj_size;
+    stats->zones = pool->zone_count;
+    stats->mapped_bytes = pool->mapped_bytes;
+    stats->capacity = 0;
+    for (zone = pool->zones; zone; zone = zone->next)
+        stats->capacity += (size_t)(zone->end - zone->first) / pool->obj_size;
+    stats->in_use = pool->in_use;
+    stats->magazine_refills = pool->refills;
+    stats->magazine_flushes = pool->flushes;
+    malloc_unlock(&pool->lock);
+    return 0;
+}
+
+
+/*
+ * show_alloc_mem part for pools: every zone with the objects carved from
+ * it so far, returns the bytes in use
+ */
+size_t show_pools(void)
+{
+    t_pool      *pool;
+    t_pool_zone *zone;
+    size_t      total_bytes;
+
+    total_bytes = 0;
+    pthread_mutex_lock(&g_pools_mutex);
+    for (pool = g_pools; pool; pool = pool->next)
+    {
+        malloc_lock(&pool->lock);
+        printf("POOL : %p\n", (void *)pool);
+        for (zone = pool->zones; zone; zone = zone->next)
+        {
+            printf("%p - %p : %zu objects of %zu bytes\n", (void *)zone->first,
+                (void *)(zone->end - 1), (size_t)(zone->end - zone->first) / pool->obj_size,
+                pool->obj_size);
+        }
+        printf("%zu objects in use\n", pool->in_use);
+        total_bytes += pool->in_use * pool->obj_size;
+        malloc_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&g_pools_mutex);
+    return total_bytes;
+}
+
+
+/*
+ * objects of a pool held in the magazines of all threads, registry lock
+ * and pool lock held. other threads move objects in and out of their
+ * magazines without either, so the count is a close estimate
+ */
+static size_t magazine_count(t_pool *pool)
+{
+    t_magazine_set  *set;
+    t_magazine      *magazine;
+    size_t          count;
+
+    count = 0;
+    for (set = g_magazine_sets; set; set = set->next)
+    {
+        magazine = &set->magazines[pool->id % POOL_MAGAZINE_SLOTS];
+        if (__atomic_load_n(&magazine->pool, __ATOMIC_RELAXED) == pool &&
+            __atomic_load_n(&magazine->id, __ATOMIC_RELAXED) == pool->id)
+            count += __atomic_load_n(&magazine->count, __ATOMIC_RELAXED);
+    }
+    return (count < pool->in_use ? count : pool->in_use);
+}
+
+
+/*
+ * malloc_analyze part for pools: bytes mapped by every pool, and of their
+ * objects out of the shared lists, those handed out and those parked in a
+ * thread's magazine
+ */
+void pool_analyze(size_t *mapped, size_t *live, size_t *parked)
+{
+    t_pool  *pool;
+    size_t  in_magazines;
+
+    *mapped = 0;
+    *live = 0;
+    *parked = 0;
+    pthread_mutex_lock(&g_pools_mutex);
+    for (pool = g_pools; pool; pool = pool->next)
+    {
+        malloc_lock(&pool->lock);
+        in_magazines = magazine_count(pool);
+        *mapped += pool->mapped_bytes;
+        *live += (pool->in_use - in_magazines) * pool->obj_size;
+        *parked += in_magazines * pool->obj_size;
+        malloc_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&g_pools_mutex);
+}
+
+
+/*
+ * fork support: the registry lock, then every pool lock in list order;
+ * taken before the heap locks
+ */
+void pool_lock_all(void)
+{
+    t_pool  *pool;
+
+    pthread_mutex_lock(&g_pools_mutex);
+    for (pool = g_pools; pool; pool = pool->next)
+        malloc_lock(&pool->lock);
+}
+
+
+/* release what pool_lock_all acquired (parent side of fork) */
+void pool_unlock_all(void)
+{
+    t_pool  *pool;
+
+    for (pool = g_pools; pool; pool = pool->next)
+        malloc_unlock(&pool->lock);
+    pthread_mutex_unlock(&g_pools_mutex);
+}
+
+
+/*
+ * child side of fork: reinitialize every pool lock and the registry lock;
+ * only this thread's magazines survived
+ */
+void pool_reset_locks(void)
+{
+    t_pool  *pool;
+
+    for (pool = g_pools; pool; pool = pool->next)
+        lock_init(&pool->lock);
+    pthread_mutex_init(&g_pools_mutex, NULL);
+    g_magazine_sets = NULL;
+    if (t_magazine_registered)
+    {
+        t_set.next = NULL;
+        t_set.prev = NULL;
+        g_magazine_sets = &t_set;
+    }
+}
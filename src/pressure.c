@@ -0,0 +1,440 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   pressure.c                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+#include <fcntl.h>
+
+/*
+ * Memory-pressure-aware retention.
+ *
+ * The allocator keeps memory it could give back: the last empty zone of
+ * each list, ready zones of the background thread, cached LARGE zones and
+ * free pages below the purge threshold. How much of that is worth keeping
+ * depends on how close the process is to its cgroup limit, so the
+ * background thread, or when it is not running the first allocation to
+ * return after a new zone was mapped, looks at memory.current /
+ * memory.max of the process's cgroup v2 directory and at
+ * /proc/pressure/memory, at most every PRESSURE_INTERVAL_MS.
+ * bounded-latency threads never do, and free only reads the last level.
+ *
+ *   HIGH    emptied zones are unmapped and any whole free page is purged
+ *           on free; the background thread (or malloc_pressure_config)
+ *           also hands back everything retained at once
+ *   NORMAL  the usual behaviour
+ *   LOW     the background thread keeps twice the ready zones and skips
+ *           its periodic purge
+ *
+ * The files are read with open/read, never through stdio. FT_MALLOC_PRESSURE=0
+ * turns the whole thing off; FT_MALLOC_CGROUP_DIR and FT_MALLOC_PSI, or
+ * malloc_pressure_config(), point it at other files (tests use fake ones).
+ */
+
+static pthread_mutex_t  g_pressure_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char             g_current_path[PRESSURE_PATH_MAX];
+static char             g_max_path[PRESSURE_PATH_MAX];
+static char             g_psi_path[PRESSURE_PATH_MAX];
+static int              g_disabled = 0;
+static int              g_cgroup_pending = 0;   // default cgroup dir not looked up yet
+static int              g_level = MALLOC_PRESSURE_NORMAL;
+static uint64_t         g_last_poll = 0;
+static int              g_poll_pending = 0;     // a zone was mapped since the last look
+static t_pressure_stats g_stats = {MALLOC_PRESSURE_NORMAL, 0, 0, -1, 0, 0, 0};
+
+
+/* read a small file into buf as a string, -1 if it cannot be read */
+static ssize_t read_file(const char *path, char *buf, size_t size)
+{
+    ssize_t len;
+    int     fd;
+
+    if (!path[0])
+        return -1;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+    return len;
+}
+
+
+/* parse a decimal number; "max" reads as 0 (no limit). -1 on garbage */
+static int parse_size(const char *str, size_t *value)
+{
+    *value = 0;
+    if (str[0] == 'm' && str[1] == 'a' && str[2] == 'x')
+        return 0;
+    if (*str < '0' || *str > '9')
+        return -1;
+    while (*str >= '0' && *str <= '9')
+        *value = *value * 10 + (size_t)(*str++ - '0');
+    return 0;
+}
+
+
+/* "some avg10=12.34 ..." -> 1234, -1 if not found */
+static int parse_psi(const char *str)
+{
+    const char  *key = "some avg10=";
+    int         value;
+    int         i;
+
+    for (i = 0; key[i]; i++)
+    {
+        if (str[i] != key[i])
+            return -1;
+    }
+    str += i;
+    value = 0;
+    while (*str >= '0' && *str <= '9')
+        value = value * 10 + (*str++ - '0');
+    if (*str++ != '.')
+        return -1;
+    for (i = 0; i < 2; i++)
+    {
+        value *= 10;
+        if (*str >= '0' && *str <= '9')
+            value += *str++ - '0';
+    }
+    return value;
+}
+
+
+/*
+ * the cgroup v2 directory of this process: the "0::" line of
+ * /proc/self/cgroup under /sys/fs/cgroup (or /sys/fs/cgroup/unified on
+ * hybrid hierarchies); empty if there is no memory.max to watch
+ */
+static void default_cgroup_dir(char *dir)
+{
+    static const char   *roots[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+    char                buf[1024];
+    char                *line;
+    char                *end;
+    size_t              len;
+    size_t              i;
+    int                 fd;
+
+    dir[0] = '\0';
+    if (read_file("/proc/self/cgroup", buf, sizeof(buf)) < 0)
+        return;
+    line = buf;
+    while (*line && !(line[0] == '0' && line[1] == ':' && line[2] == ':'))
+    {
+        while (*line && *line != '\n')
+            line++;
+        if (*line)
+            line++;
+    }
+    if (!*line)
+        return;
+    line += 3;
+    for (end = line; *end && *end != '\n'; end++)
+        ;
+    *end = '\0';
+
+    for (i = 0; i < sizeof(roots) / sizeof(roots[0]); i++)
+    {
+        len = append_str(dir, 0, PRESSURE_PATH_MAX, roots[i]);
+        if (line[0] == '/' && line[1])
+            len = append_str(dir, len, PRESSURE_PATH_MAX, line);
+        append_str(dir, len, PRESSURE_PATH_MAX, "/memory.max");
+        fd = open(dir, O_RDONLY | O_CLOEXEC);
+        dir[len] = '\0';
+        if (fd >= 0)
+        {
+            close(fd);
+            return;
+        }
+    }
+    dir[0] = '\0';
+}
+
+
+/* point the cgroup readers at dir, "" leaves them out */
+static void set_cgroup_dir(const char *dir)
+{
+    size_t  len;
+
+    g_current_path[0] = '\0';
+    g_max_path[0] = '\0';
+    if (dir[0])
+    {
+        len = append_str(g_current_path, 0, PRESSURE_PATH_MAX, dir);
+        append_str(g_current_path, len, PRESSURE_PATH_MAX, "/memory.current");
+        len = append_str(g_max_path, 0, PRESSURE_PATH_MAX, dir);
+        append_str(g_max_path, len, PRESSURE_PATH_MAX, "/memory.max");
+    }
+}
+
+
+/*
+ * point the readers at a cgroup directory and a PSI file: NULL picks the
+ * default, "" leaves that source out. the default cgroup directory takes
+ * reading /proc, so it is only looked up by the first reading. pressure
+ * mutex held, or malloc_init
+ */
+static void set_paths(const char *cgroup_dir, const char *psi_path)
+{
+    g_cgroup_pending = (cgroup_dir == NULL);
+    set_cgroup_dir(cgroup_dir ? cgroup_dir : "");
+
+    if (!psi_path)
+        psi_path = "/proc/pressure/memory";
+    append_str(g_psi_path, 0, PRESSURE_PATH_MAX, psi_path);
+}
+
+
+/*
+ * read FT_MALLOC_PRESSURE and the path overrides, once from malloc_init;
+ * no file is opened until the first reading
+ */
+void pressure_init(void)
+{
+    const char  *value;
+
+    value = getenv("FT_MALLOC_PRESSURE");
+    if (value && value[0] == '0' && !value[1])
+    {
+        g_disabled = 1;
+        return;
+    }
+    set_paths(getenv("FT_MALLOC_CGROUP_DIR"), getenv("FT_MALLOC_PSI"));
+}
+
+
+/* level from the last readings; no source at all means NORMAL */
+static int compute_level(void)
+{
+    size_t  headroom;
+    int     level;
+    bool    known;
+
+    level = MALLOC_PRESSURE_LOW;
+    known = false;
+    if (g_stats.limit)
+    {
+        known = true;
+        headroom = g_stats.current < g_stats.limit ? g_stats.limit - g_stats.current : 0;
+        if (headroom * 100 < g_stats.limit * PRESSURE_HIGH_PCT)
+            level = MALLOC_PRESSURE_HIGH;
+        else if (headroom * 100 < g_stats.limit * PRESSURE_LOW_PCT)
+            level = MALLOC_PRESSURE_NORMAL;
+    }
+    if (g_stats.psi_some_avg10 >= 0)
+    {
+        known = true;
+        if (g_stats.psi_some_avg10 >= PRESSURE_PSI_HIGH)
+            level = MALLOC_PRESSURE_HIGH;
+        else if (g_stats.psi_some_avg10 >= PRESSURE_PSI_LOW && level == MALLOC_PRESSURE_LOW)
+            level = MALLOC_PRESSURE_NORMAL;
+    }
+    return (known ? level : MALLOC_PRESSURE_NORMAL);
+}
+
+
+/* read the files and update the level, pressure mutex held */
+static int read_level(void)
+{
+    char    buf[256];
+    char    dir[PRESSURE_PATH_MAX];
+
+    if (g_cgroup_pending)
+    {
+        default_cgroup_dir(dir);
+        set_cgroup_dir(dir);
+        g_cgroup_pending = 0;
+    }
+    g_stats.current = 0;
+    g_stats.limit = 0;
+    if (read_file(g_current_path, buf, sizeof(buf)) < 0 ||
+        parse_size(buf, &g_stats.current) != 0 ||
+        read_file(g_max_path, buf, sizeof(buf)) < 0 ||
+        parse_size(buf, &g_stats.limit) != 0)
+        g_stats.limit = 0;
+
+    g_stats.psi_some_avg10 = -1;
+    if (read_file(g_psi_path, buf, sizeof(buf)) >= 0)
+        g_stats.psi_some_avg10 = parse_psi(buf);
+
+    g_stats.polls++;
+    g_last_poll = now_ms();
+    g_stats.level = compute_level();
+    return g_stats.level;
+}
+
+
+/*
+ * hand back everything the allocator retains: ready zones, cached LARGE
+ * zones beyond the reserved ones, empty zones and whole free pages. arenas
+ * with a malloc_reserve keep their pages resident, so that their
+ * bounded-latency threads never refault
+ */
+static void shrink(void)
+{
+    t_malloc_state  *arena;
+    size_t          released;
+    int             node;
+
+    released = 0;
+    for (node = 0; node < NUMA_MAX_NODES; node++)
+    {
+        arena = numa_arena_at(node);
+        if (!arena)
+            continue;
+        ready_release(arena);
+        large_cache_trim(arena);
+        released += state_release_empty(arena);
+        if (!arena->reserved)
+            released += state_purge(arena);
+    }
+
+    pthread_mutex_lock(&g_pressure_mutex);
+    g_stats.shrinks++;
+    g_stats.released_bytes += released;
+    pthread_mutex_unlock(&g_pressure_mutex);
+}
+
+
+/*
+ * re-read the pressure if the last reading is older than
+ * PRESSURE_INTERVAL_MS; returns the previous level, -1 if nothing was
+ * read. never blocks on another poller
+ */
+static int poll_level(void)
+{
+    int previous;
+
+    if (g_disabled || now_ms() - g_last_poll < PRESSURE_INTERVAL_MS)
+        return -1;
+    if (pthread_mutex_trylock(&g_pressure_mutex) != 0)
+        return -1;
+    if (now_ms() - g_last_poll < PRESSURE_INTERVAL_MS)
+    {
+        pthread_mutex_unlock(&g_pressure_mutex);
+        return -1;
+    }
+    previous = g_level;
+    g_level = read_level();
+    pthread_mutex_unlock(&g_pressure_mutex);
+    return previous;
+}
+
+
+/*
+ * background thread side: poll, and shrink when the level just turned
+ * HIGH. must be called with no allocator lock held
+ */
+void pressure_poll(void)
+{
+    int previous;
+
+    previous = poll_level();
+    if (previous >= 0 && g_level == MALLOC_PRESSURE_HIGH &&
+        previous != MALLOC_PRESSURE_HIGH)
+        shrink();
+}
+
+
+/*
+ * a zone was just mapped: the heap grew, worth a look at the pressure.
+ * may run under a state lock, so it only flips a flag
+ */
+void pressure_note_mapping(void)
+{
+    g_poll_pending = 1;
+}
+
+
+/*
+ * allocation side, with no allocator lock held: only after a zone was
+ * mapped, only while the background thread is not there to do it, and
+ * never from a bounded-latency thread. it only updates the level, what
+ * free does under HIGH is cheap; the burst of unmapping a shrink means is
+ * left to the background thread
+ */
+void pressure_check(void)
+{
+    if (!g_poll_pending || !__sync_bool_compare_and_swap(&g_poll_pending, 1, 0))
+        return;
+    if (thread_reserve_only() || background_running())
+        return;
+    poll_level();
+}
+
+
+/* the last level seen, without reading anything */
+int pressure_level(void)
+{
+    return g_level;
+}
+
+
+/* minimum whole pages a freed span needs for them to be released at once */
+size_t pressure_purge_pages(void)
+{
+    if (g_level == MALLOC_PRESSURE_HIGH)
+        return 1;
+    return (PURGE_MIN_PAGES);
+}
+
+
+/*
+ * watch another cgroup directory (holding memory.current and memory.max)
+ * and PSI file; NULL restores the default, "" ignores that source. the
+ * files are read at once and the new level is returned, -1 if
+ * FT_MALLOC_PRESSURE=0 turned pressure tracking off
+ */
+int malloc_pressure_config(const char *cgroup_dir, const char *psi_path)
+{
+    int previous;
+    int level;
+
+    malloc_init();
+    if (g_disabled)
+        return -1;
+
+    pthread_mutex_lock(&g_pressure_mutex);
+    set_paths(cgroup_dir, psi_path);
+    previous = g_level;
+    level = read_level();
+    g_level = level;
+    pthread_mutex_unlock(&g_pressure_mutex);
+
+    if (level == MALLOC_PRESSURE_HIGH && previous != MALLOC_PRESSURE_HIGH)
+        shrink();
+    return level;
+}
+
+
+/*
+ * after fork, in the child: a poller of another thread may have held the
+ * mutex, so it is reset
+ */
+void pressure_atfork_child(void)
+{
+    pthread_mutex_init(&g_pressure_mutex, NULL);
+}
+
+
+/* copy the last readings and the shrink counters */
+int malloc_pressure_stats(t_pressure_stats *stats)
+{
+    pthread_mutex_lock(&g_pressure_mutex);
+    *stats = g_stats;
+    stats->level = g_level;
+    pthread_mutex_unlock(&g_pressure_mutex);
+    return 0;
+}
@@ -0,0 +1,225 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   purge.c                                            :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+extern t_malloc_state g_malloc_state;
+
+/*
+ * Interior page release for TINY/SMALL/MEDIUM zones.
+ *
+ * The whole pages strictly inside a free block (after its header, before
+ * its footer) hold nothing the allocator needs, so they can be handed back
+ * with MADV_DONTNEED while the zone stays mapped. zone->decommitted has one
+ * bit per page of the zone (per group of pages for MEDIUM chunks of more
+ * than 64 pages); a bit is cleared again as soon as any part of the page is
+ * handed out, because the kernel faults it back in on touch.
+ *
+ * Together with zone->dirty (nothing past it has been written since the
+ * zone was mapped) the bits tell which memory is known to be zero, which
+ * lets calloc skip zeroing it.
+ */
+
+
+/* bytes covered by one bit of zone->decommitted: whole pages, 64 at most */
+static size_t purge_unit(t_zone *zone)
+{
+    size_t  page;
+    size_t  pages;
+
+    page = getpagesize();
+    pages = zone->zone_size / page;
+    return (page * ((pages + 63) / 64));
+}
+
+
+/* bit index range [first, end) of the zone overlapping [start, stop) */
+static void page_span(t_zone *zone, char *start, char *stop, size_t *first, size_t *end)
+{
+    size_t  unit;
+
+    unit = purge_unit(zone);
+    *first = (size_t)(start - (char *)zone) / unit;
+    *end = ((size_t)(stop - (char *)zone) + unit - 1) / unit;
+}
+
+
+/*
+ * a block (plus the header that may follow it) is about to be written:
+ * it is dirty from now on and its pages are resident again
+ */
+void zone_commit_block(t_zone *zone, t_block *block)
+{
+    size_t  first;
+    size_t  end;
+    char    *stop;
+
+    stop = (char *)block + block->size + sizeof(t_block);
+    if (stop > (char *)zone + zone->zone_size)
+        stop = (char *)zone + zone->zone_size;
+    if ((size_t)(stop - (char *)zone) > zone->dirty)
+        zone->dirty = stop - (char *)zone;
+
+    if (zone->zone_type == LARGE || !zone->decommitted)
+        return;
+
+    page_span(zone, (char *)block, stop, &first, &end);
+    while (first < end)
+        zone->decommitted &= ~(1ULL << first++);
+}
+
+
+/*
+ * zero the user area of a block about to be handed out, except for what is
+ * known to be zero already: everything past zone->dirty and decommitted
+ * pages. must run before zone_commit_block forgets about both
+ */
+void zone_zero_block(t_zone *zone, t_block *block)
+{
+    size_t  unit;
+    char    *start;
+    char    *stop;
+    char    *next;
+
+    start = PTR_FROM_BLOCK(block);
+    stop = start + get_user_size(block);
+    if (stop > (char *)zone + zone->dirty)
+        stop = (char *)zone + zone->dirty;
+    if (start >= stop)
+        return;
+    if (!zone->decommitted)
+    {
+        ft_bzero(start, stop - start);
+        return;
+    }
+
+    /* page by page, skipping the released ones */
+    unit = purge_unit(zone);
+    while (start < stop)
+    {
+        next = (char *)zone + ROUND_UP((size_t)(start - (char *)zone) + 1, unit);
+        if (next > stop)
+            next = stop;
+        if (!(zone->decommitted & (1ULL << ((size_t)(start - (char *)zone) / unit))))
+            ft_bzero(start, next - start);
+        start = next;
+    }
+}
+
+
+/*
+ * release the interior pages of a free block if it spans at least
+ * min_pages of them; returns the number of bytes newly released
+ */
+size_t zone_purge_block(t_zone *zone, t_block *block, size_t min_pages)
+{
+    size_t  unit;
+    char    *start;
+    char    *stop;
+    size_t  first;
+    size_t  end;
+    size_t  released;
+    size_t  run;
+
+    if (zone->zone_type == LARGE || !block->is_free)
+        return 0;
+
+    unit = purge_unit(zone);
+    start = (char *)zone + ROUND_UP((size_t)((char *)block + sizeof(t_block) - (char *)zone), unit);
+    stop = (char *)zone + (size_t)((char *)FOOTER(block) - (char *)zone) / unit * unit;
+    if (stop <= start || (size_t)(stop - start) / getpagesize() < min_pages)
+        return 0;
+
+    first = (size_t)(start - (char *)zone) / unit;
+    end = (size_t)(stop - (char *)zone) / unit;
+    released = 0;
+
+    /* madvise each run of pages that is still resident */
+    while (first < end)
+    {
+        if (zone->decommitted & (1ULL << first))
+        {
+            first++;
+            continue;
+        }
+        run = first;
+        while (run < end && !(zone->decommitted & (1ULL << run)))
+            zone->decommitted |= 1ULL << run++;
+        madvise((char *)zone + first * unit, (run - first) * unit, MADV_DONTNEED);
+        released += (run - first) * unit;
+        first = run;
+    }
+    return released;
+}
+
+
+/* purge every free block of a zone list */
+static size_t purge_zone_list(t_zone *zone)
+{
+    t_block *block;
+    size_t  released;
+
+    released = 0;
+    while (zone)
+    {
+        block = zone->first;
+        while (block)
+        {
+            if (block->is_free)
+                released += zone_purge_block(zone, block, 1);
+
+            if ((char *)block + block->size < (char *)zone + zone->zone_size)
+                block = (t_block *)((char *)block + block->size);
+            else
+                break;
+        }
+        zone = zone->next;
+    }
+    return released;
+}
+
+
+/*
+ * release every whole free page inside the TINY/SMALL/MEDIUM zones of a state
+ */
+size_t state_purge(t_malloc_state *state)
+{
+    size_t  released;
+
+    malloc_lock(&state->lock);
+    released = purge_zone_list(state->tiny_zones);
+    released += purge_zone_list(state->small_zones);
+    released += purge_zone_list(state->medium_zones);
+    malloc_unlock(&state->lock);
+    return released;
+}
+
+
+/*
+ * release every whole free page of the global zones (and of every NUMA
+ * node arena) back to the system, returns the number of bytes released
+ */
+size_t malloc_purge(void)
+{
+    t_malloc_state  *arena;
+    size_t          released;
+    int             node;
+
+    released = state_purge(&g_malloc_state);
+    for (node = 1; node < NUMA_MAX_NODES; node++)
+    {
+        arena = numa_arena_at(node);
+        if (arena)
+            released += state_purge(arena);
+    }
+    return released;
+}
@@ -11,38 +11,96 @@
 /* ************************************************************************** */
 
 #include "../inc/malloc.h"
+#include <errno.h>
 
 
-extern t_malloc_state g_malloc_state;
-
-/* copy data from src to dst, up to size bytes */
-static void ft_memcpy(void *dst, const void *src, size_t size)
+/*
+ * find the zone and block of a pointer owned by state;
+ * must be called with the state mutex held
+ */
+static t_zone *zone_for_realloc(t_malloc_state *state, void *ptr, t_block **block_ptr)
 {
-    size_t      i;
-    char        *d;
-    const char  *s;
-
-    d = (char *)dst;
-    s = (const char *)src;
-    i = 0;
-    while (i < size)
+    t_zone  *zone;
+
+    zone = large_find(state, ptr);
+    if (zone)
     {
-        d[i] = s[i];
-        i++;
+        *block_ptr = zone->first;
+        return zone;
     }
+    return (find_zone_for_ptr(state, ptr, block_ptr));
+}
+
+
+/* block size holding size user bytes in a zone: MEDIUM runs are whole pages */
+static size_t block_size_in(t_zone *zone, size_t size)
+{
+    if (zone->zone_type == MEDIUM)
+        return (medium_run_size(BLOCK_SIZE(ALIGN(size))));
+    return (BLOCK_SIZE(ALIGN(size)));
 }
 
 
+/* largest block that may stay in the size class of a zone */
+static size_t class_ceiling(t_zone *zone)
+{
+    if (zone->zone_type == LARGE)
+        return ((size_t)-1);
+    if (zone->zone_type == MEDIUM)
+        return (medium_run_size(BLOCK_SIZE(MEDIUM_MAX)));
+    return (BLOCK_SIZE(SMALL_MAX));
+}
+
+
+/*
+ * shrink an allocated block in place to new_size bytes; MEDIUM neighbours
+ * are rebinned around the split. state lock held
+ */
+static void shrink_block(t_malloc_state *state, t_zone *zone, t_block *block, size_t new_size)
+{
+    if (zone->zone_type == MEDIUM)
+        medium_resize_begin(state, zone, block);
+    split_block(zone, block, new_size);
+    if (zone->zone_type == MEDIUM)
+        medium_resize_end(state, zone, block);
+}
+
 
+/*
+ * user bytes to request when a block that keeps growing has to move:
+ * geometric headroom once the block has shown a growth pattern
+ */
+static size_t growth_request(t_block *block, size_t size, unsigned int hint)
+{
+    size_t  reserve;
+    size_t  target;
+
+    if (hint < GROW_HINT_THRESHOLD)
+        return size;
+
+    reserve = get_user_size(block);
+    if (reserve > GROW_RESERVE_MAX)
+        reserve = GROW_RESERVE_MAX;
+    target = get_user_size(block) + reserve;
+    if (target > MAX_ALLOC_SIZE)
+        return size;
+    return (target > size ? target : size);
+}
 
 
 /* realloc implementation */
 void *realloc(void *ptr, size_t size)
 {
+    t_malloc_state  *state;
     void    *new_ptr;
+    t_zone  *zone;
     t_block *block;
+    t_block *grown;
     size_t  user_size;
     size_t  aligned_size;
+    size_t  request;
+    unsigned int hint;
+    uint32_t lifetime;
 
     // handle edge cases
     if (!ptr)
@@ -52,47 +110,86 @@ void *realloc(void *ptr, size_t size)
         free(ptr);
         return NULL;
     }
+    if (size > MAX_ALLOC_SIZE)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
 
+    state = numa_owner(ptr);
+    malloc_lock(&state->lock);
 
-    pthread_mutex_lock(&g_malloc_state.mutex);
-
+    /* getting zone and block header from ptr, rejecting unknown pointers */
+    zone = zone_for_realloc(state, ptr, &block);
+    if (!zone || !block || block->is_free)
+    {
+        malloc_unlock(&state->lock);
+        return NULL;
+    }
 
-    /* getting block header from ptr */
-    block = BLOCK_FROM_PTR(ptr);
+    /* calculate required size with alignment */
+    aligned_size = block_size_in(zone, size);
 
     /* getting current user size */
     user_size = get_user_size(block);
 
-    /* calculate required size with alignment */
-    aligned_size = BLOCK_SIZE(ALIGN(size));
-
-    /* if new size fits in current block, return same pointer */
+    /*
+     * if new size fits in current block, return same pointer. a growing
+     * block keeps its headroom unless it shrinks below half of it
+     */
     if (aligned_size <= block->size)
     {
-        /* if the block is much larger than needed, split it */
-        if (block->size >= aligned_size + BLOCK_SIZE(1))
-            split_block(block, aligned_size);
+        if (block->grow_hint == 0 || aligned_size * 2 <= block->size)
+        {
+            block->grow_hint = 0;
+            shrink_block(state, zone, block, aligned_size);
+        }
 
-        pthread_mutex_unlock(&g_malloc_state.mutex);
+        malloc_unlock(&state->lock);
         return ptr;
     }
 
-    /* try to extend the block if possible */
-    if (try_extend_block(block, aligned_size))
+    /* the block is growing: remember it, and the lifetime class it was given */
+    hint = block->grow_hint;
+    lifetime = zone->lifetime;
+    if (hint < GROW_HINT_MAX)
+        hint++;
+    request = growth_request(block, size, hint);
+
+    /*
+     * try to grow in place, forward and then backward, as long as the
+     * block stays in its size class; crossing the class ceiling moves it.
+     * headroom is taken in place when there is room for it
+     */
+    if (zone->zone_type == MEDIUM)
+        medium_resize_begin(state, zone, block);
+    if (block_size_in(zone, request) <= class_ceiling(zone))
+        grown = try_extend_block(zone, block, block_size_in(zone, request));
+    else
+        grown = NULL;
+    if (!grown && aligned_size <= class_ceiling(zone))
+        grown = try_extend_block(zone, block, aligned_size);
+    if (zone->zone_type == MEDIUM)
+        medium_resize_end(state, zone, grown ? grown : block);
+    if (grown)
     {
-        pthread_mutex_unlock(&g_malloc_state.mutex);
-        return ptr;
+        grown->grow_hint = hint;
+        malloc_unlock(&state->lock);
+        return (PTR_FROM_BLOCK(grown));
     }
 
-    /* unlock before calling malloc */
-    pthread_mutex_unlock(&g_malloc_state.mutex);
+    /* unlock before allocating */
+    malloc_unlock(&state->lock);
 
-    /* allocate new memory */
-    new_ptr = malloc(size);
+    /* allocate new memory, promoting straight to a LARGE zone if needed */
+    if (BLOCK_SIZE(ALIGN(request)) > BLOCK_SIZE(MEDIUM_MAX))
+        new_ptr = allocate_large(numa_arena(), BLOCK_SIZE(ALIGN(request)), hint);
+    else
+        new_ptr = state_malloc_lifetime(numa_arena(), request, lifetime, hint);
     if (!new_ptr)
         return NULL;
 
-    /* copy data to the new location */
+    /* copy data to the new location, the only copy on this path */
     ft_memcpy(new_ptr, ptr, user_size < size ? user_size : size);
 
 
@@ -103,3 +200,49 @@ void *realloc(void *ptr, size_t size)
     return (new_ptr);
 
 }
+
+
+/*
+ * capacity of an allocated block, including any growth headroom
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    t_malloc_state  *state;
+    t_zone  *zone;
+    t_block *block;
+    size_t  usable;
+
+    if (!ptr)
+        return 0;
+
+    state = numa_owner(ptr);
+    malloc_lock(&state->lock);
+    zone = zone_for_realloc(state, ptr, &block);
+    usable = (zone && block && !block->is_free) ? get_user_size(block) : 0;
+    malloc_unlock(&state->lock);
+    return usable;
+}
+
+
+/*
+ * explicit trim: give back growth headroom beyond size, never moves
+ */
+void realloc_trim(void *ptr, size_t size)
+{
+    t_malloc_state  *state;
+    t_zone  *zone;
+    t_block *block;
+
+    if (!ptr)
+        return;
+
+    state = numa_owner(ptr);
+    malloc_lock(&state->lock);
+    zone = zone_for_realloc(state, ptr, &block);
+    if (zone && block && !block->is_free && block_size_in(zone, size) <= block->size)
+    {
+        block->grow_hint = 0;
+        shrink_block(state, zone, block, block_size_in(zone, size));
+    }
+    malloc_unlock(&state->lock);
+}
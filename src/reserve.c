@@ -0,0 +1,228 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   reserve.c                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+extern t_malloc_state g_malloc_state;
+
+/*
+ * Bounded-latency mode.
+ *
+ * malloc_reserve() maps and pre-faults (optionally mlocks) spare TINY/SMALL
+ * zones and LARGE zones ahead of time. A thread that switched itself to
+ * MALLOC_POLICY_RESERVE_ONLY never calls mmap, munmap or madvise from
+ * malloc/free: new zones come from the reserve, LARGE blocks come from the
+ * LARGE cache, emptied zones go back to the reserve, and when the reserve
+ * is exhausted malloc fails at once instead of going to the kernel.
+ * Other threads neither take from nor add to the reserve.
+ */
+
+static __thread int t_policy = MALLOC_POLICY_DEFAULT;
+
+
+/* switch the calling thread's policy, returns the previous one */
+int malloc_set_thread_policy(int policy)
+{
+    int previous;
+
+    previous = t_policy;
+    t_policy = policy;
+    return previous;
+}
+
+
+/* true if the calling thread must stay off the kernel */
+bool thread_reserve_only(void)
+{
+    return (t_policy == MALLOC_POLICY_RESERVE_ONLY);
+}
+
+
+/* fault every page of a fresh zone in now rather than on first use */
+int prefault_zone(t_zone *zone, int flags)
+{
+    size_t  page;
+    size_t  offset;
+
+    if (flags & MALLOC_RESERVE_MLOCK)
+        return (mlock(zone, zone->zone_size));
+
+    /* the zone header page is already resident; pages are still zero */
+    page = getpagesize();
+    for (offset = page; offset < zone->zone_size; offset += page)
+        ((volatile char *)zone)[offset] = 0;
+    return 0;
+}
+
+
+/* map, pre-fault and stash count zones of one type */
+static int reserve_zones(t_malloc_state *state, t_zone_type zone_type,
+    size_t size, size_t count, int flags)
+{
+    t_zone  *zone;
+
+    while (count-- > 0)
+    {
+        zone = map_zone(zone_type, size, state->node);
+        if (!zone)
+            return -1;
+        if (prefault_zone(zone, flags) != 0)
+        {
+            munmap(zone, zone->zone_size);
+            return -1;
+        }
+
+        malloc_lock(&state->lock);
+        state->reserved = 1;
+        if (zone_type == LARGE)
+        {
+            zone->next = state->large_cache;
+            state->large_cache = zone;
+            state->reserved_large++;
+        }
+        else
+        {
+            zone->next = state->reserve[zone_type];
+            state->reserve[zone_type] = zone;
+            state->reserve_count[zone_type]++;
+        }
+        malloc_unlock(&state->lock);
+    }
+    return 0;
+}
+
+
+/*
+ * reserve tiny_zones TINY zones, small_zones SMALL zones and large_count
+ * LARGE zones able to hold large_size bytes each. flags may contain
+ * MALLOC_RESERVE_MLOCK. returns 0, or -1 if the kernel refused memory
+ */
+int malloc_reserve(size_t tiny_zones, size_t small_zones,
+    size_t large_size, size_t large_count, int flags)
+{
+    malloc_init();
+
+    if (large_count && large_size > MAX_ALLOC_SIZE)
+        return -1;
+    if (reserve_zones(&g_malloc_state, TINY, 0, tiny_zones, flags) != 0 ||
+        reserve_zones(&g_malloc_state, SMALL, 0, small_zones, flags) != 0 ||
+        reserve_zones(&g_malloc_state, LARGE, BLOCK_SIZE(ALIGN(large_size)),
+            large_count, flags) != 0)
+        return -1;
+    return 0;
+}
+
+
+/*
+ * take a spare TINY/SMALL zone, state lock held; NULL when exhausted
+ */
+t_zone *reserve_take_zone(t_malloc_state *state, t_zone_type zone_type)
+{
+    t_zone  *zone;
+
+    zone = state->reserve[zone_type];
+    if (!zone)
+        return NULL;
+    state->reserve[zone_type] = zone->next;
+    state->reserve_count[zone_type]--;
+    zone->next = NULL;
+    return zone;
+}
+
+
+/*
+ * give an emptied TINY/SMALL zone (already unlinked) back to the reserve,
+ * state lock held
+ */
+void reserve_put_zone(t_malloc_state *state, t_zone *zone)
+{
+    init_zone(zone, zone->zone_type, zone->zone_size);
+    zone->next = state->reserve[zone->zone_type];
+    state->reserve[zone->zone_type] = zone;
+    state->reserve_count[zone->zone_type]++;
+}
+
+
+/*
+ * best-fit a cached LARGE zone for a block of size bytes; the returned
+ * zone is unlinked and reinitialized, NULL if nothing fits
+ */
+t_zone *large_cache_take(t_malloc_state *state, size_t size)
+{
+    t_zone  **link;
+    t_zone  **best;
+    t_zone  *zone;
+    size_t  needed;
+
+    needed = zone_size_for(LARGE, size);
+    best = NULL;
+
+    malloc_lock(&state->lock);
+    for (link = &state->large_cache; *link; link = &(*link)->next)
+    {
+        if ((*link)->zone_size >= needed &&
+            (!best || (*link)->zone_size < (*best)->zone_size))
+            best = link;
+    }
+    zone = best ? *best : NULL;
+    if (zone)
+        *best = zone->next;
+    malloc_unlock(&state->lock);
+
+    if (zone)
+        init_zone(zone, LARGE, zone->zone_size);
+    return zone;
+}
+
+
+/*
+ * keep an unregistered LARGE zone for reuse instead of unmapping it
+ */
+void large_cache_put(t_malloc_state *state, t_zone *zone)
+{
+    malloc_lock(&state->lock);
+    zone->next = state->large_cache;
+    state->large_cache = zone;
+    malloc_unlock(&state->lock);
+}
+
+
+/*
+ * unmap the cached LARGE zones beyond the ones malloc_reserve asked for,
+ * returns how many went
+ */
+size_t large_cache_trim(t_malloc_state *state)
+{
+    t_zone  **link;
+    t_zone  *excess;
+    t_zone  *next;
+    size_t  kept;
+    size_t  trimmed;
+
+    malloc_lock(&state->lock);
+    link = &state->large_cache;
+    for (kept = 0; *link && kept < state->reserved_large; kept++)
+        link = &(*link)->next;
+    excess = *link;
+    *link = NULL;
+    malloc_unlock(&state->lock);
+
+    trimmed = 0;
+    while (excess)
+    {
+        next = excess->next;
+        munmap(excess, excess->zone_size);
+        trimmed++;
+        excess = next;
+    }
+    return trimmed;
+}
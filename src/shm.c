@@ -0,0 +1,400 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   shm.c                                              :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#define _GNU_SOURCE
+#include "../inc/malloc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * Shared-memory heap.
+ *
+ * A memfd or shm_open region holds a header and one zone that is run by
+ * the usual zone machinery: t_block headers, boundary-tag footers,
+ * find_free_block / split_block / merge_free_blocks. Those walk blocks by
+ * size and footer only and find the first block with ZONE_FIRST, so they
+ * work at whatever address a process maps the region. Nothing stored in
+ * the region is a pointer: the header names the zone and the published
+ * root object by offset from the region start, zone->first and zone->next
+ * are left NULL, and objects are handed out and passed around as offsets
+ * (shm_ptr turns one into a local pointer).
+ *
+ * The header mutex is process-shared and robust. If a process dies holding
+ * it, the next one to lock it walks the blocks again; when the walk does
+ * not add up the heap is marked broken and every later call fails.
+ */
+
+
+/* the zone inside the region */
+static t_zone *shm_zone(t_shm_heap *heap)
+{
+    return ((t_zone *)((char *)heap->base + heap->base->zone));
+}
+
+
+/*
+ * walk the zone after a holder died: every block in bounds, footers equal
+ * to sizes, sizes adding up to the zone. recounts the free blocks
+ */
+static bool shm_check(t_shm_heap *heap)
+{
+    t_zone  *zone;
+    t_block *block;
+    char    *end;
+    size_t  free_blocks;
+
+    zone = shm_zone(heap);
+    end = (char *)zone + zone->zone_size;
+    block = ZONE_FIRST(zone);
+    free_blocks = 0;
+    while ((char *)block < end)
+    {
+        if (block->size < BLOCK_SIZE(0) || block->size > (size_t)(end - (char *)block) ||
+            *FOOTER(block) != block->size)
+            return false;
+        if (block->is_free)
+            free_blocks++;
+        block = (t_block *)((char *)block + block->size);
+    }
+    if ((char *)block != end)
+        return false;
+    zone->free_blocks = free_blocks;
+    return true;
+}
+
+
+/*
+ * take the heap mutex, recovering it from a dead holder; -1 if the heap is
+ * (or has just been found) broken
+ */
+static int shm_lock(t_shm_heap *heap)
+{
+    int result;
+
+    result = pthread_mutex_lock(&heap->base->mutex);
+    if (result == EOWNERDEAD)
+    {
+        if (!shm_check(heap))
+            heap->base->broken = 1;
+        pthread_mutex_consistent(&heap->base->mutex);
+        result = 0;
+    }
+    if (result != 0)
+        return -1;
+    if (heap->base->broken)
+    {
+        pthread_mutex_unlock(&heap->base->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* map a region and wrap it in a handle of this process; NULL on failure */
+static t_shm_heap *shm_map(int fd, size_t size)
+{
+    t_shm_heap  *heap;
+    void        *base;
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    /* the handle lives in its own mapping, independent of malloc */
+    heap = mmap(NULL, sizeof(t_shm_heap), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap == MAP_FAILED)
+    {
+        munmap(base, size);
+        return NULL;
+    }
+    heap->base = base;
+    heap->size = size;
+    heap->fd = fd;
+    return heap;
+}
+
+
+/* set up the header, the shared mutex and the zone of a fresh region */
+static int shm_format(t_shm_heap *heap)
+{
+    pthread_mutexattr_t attr;
+    t_shm_header        *header;
+    t_zone              *zone;
+    int                 result;
+
+    header = heap->base;
+    header->size = heap->size;
+    header->zone = ROUND_UP(sizeof(t_shm_header), CACHE_LINE);
+    header->root = 0;
+    header->broken = 0;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    result = pthread_mutex_init(&header->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (result != 0)
+        return -1;
+
+    /* an ordinary zone, minus the pointers */
+    zone = shm_zone(heap);
+    init_zone(zone, SMALL, heap->size - header->zone);
+    zone->first = NULL;
+    zone->next = NULL;
+
+    /* published last: attaching processes check it */
+    __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/*
+ * create a shared heap of size bytes: in a new POSIX shared memory object
+ * called name (remove it with shm_unlink when done), or in an anonymous
+ * memfd when name is NULL (hand shm_heap_fd to the other processes)
+ */
+t_shm_heap *shm_heap_create(const char *name, size_t size)
+{
+    t_shm_heap  *heap;
+    int         fd;
+
+    if (size > MAX_ALLOC_SIZE)
+        return NULL;
+    if (size < SHM_MIN_SIZE)
+        size = SHM_MIN_SIZE;
+    size = ROUND_UP(size, (size_t)getpagesize());
+
+    if (name)
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    else
+        fd = memfd_create("ft_malloc_shm", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    heap = NULL;
+    if (ftruncate(fd, size) != 0 || !(heap = shm_map(fd, size)) || shm_format(heap) != 0)
+    {
+        /* the name was ours, nobody else may find a half made heap */
+        if (heap)
+            shm_heap_close(heap);
+        else
+            close(fd);
+        if (name)
+            shm_unlink(name);
+        return NULL;
+    }
+    return heap;
+}
+
+
+/*
+ * map an existing shared heap from its file descriptor (a memfd received
+ * from its creator, or an shm_open'ed one); the handle takes the fd over
+ */
+t_shm_heap *shm_heap_attach(int fd)
+{
+    struct stat st;
+    t_shm_heap  *heap;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_MIN_SIZE)
+        return NULL;
+    heap = shm_map(fd, st.st_size);
+    if (!heap)
+        return NULL;
+    if (__atomic_load_n(&heap->base->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+        heap->base->size != heap->size)
+    {
+        munmap(heap->base, heap->size);
+        munmap(heap, sizeof(t_shm_heap));
+        return NULL;
+    }
+    return heap;
+}
+
+
+/* map the shared heap called name, created by shm_heap_create */
+t_shm_heap *shm_heap_open(const char *name)
+{
+    t_shm_heap  *heap;
+    int         fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    heap = shm_heap_attach(fd);
+    if (!heap)
+        close(fd);
+    return heap;
+}
+
+
+/* file descriptor of the region, for passing to another process */
+int shm_heap_fd(t_shm_heap *heap)
+{
+    return (heap ? heap->fd : -1);
+}
+
+
+/* unmap the heap from this process; the region lives on in the others */
+void shm_heap_close(t_shm_heap *heap)
+{
+    if (!heap)
+        return;
+    munmap(heap->base, heap->size);
+    close(heap->fd);
+    munmap(heap, sizeof(t_shm_heap));
+}
+
+
+/* allocate size bytes in the shared heap, returns the offset or 0 */
+t_shm_off shm_malloc(t_shm_heap *heap, size_t size)
+{
+    t_zone      *zone;
+    t_block     *block;
+    t_shm_off   offset;
+
+    if (!heap || size == 0 || size > heap->size)
+        return 0;
+    size = BLOCK_SIZE(ALIGN(size));
+
+    if (shm_lock(heap) != 0)
+        return 0;
+    zone = shm_zone(heap);
+    offset = 0;
+    block = find_free_block(zone, size);
+    if (block)
+    {
+        block = split_block(zone, block, size);
+        block->is_free = 0;
+        block->grow_hint = 0;
+        zone->free_blocks--;
+        offset = (char *)PTR_FROM_BLOCK(block) - (char *)heap->base;
+    }
+    pthread_mutex_unlock(&heap->base->mutex);
+    return offset;
+}
+
+
+/* a block header at block that fits in [first, end) and whose footer agrees */
+static bool shm_tag_ok(t_block *block, char *first, char *end)
+{
+    if ((char *)block < first || (char *)block > end - BLOCK_SIZE(0) ||
+        block->size < BLOCK_SIZE(0) ||
+        block->size > (size_t)(end - (char *)block))
+        return false;
+    return (*FOOTER(block) == block->size);
+}
+
+
+/*
+ * the live block whose user pointer is ptr, or NULL. Checked from the
+ * boundary tags alone: the header is in bounds with a matching footer, the
+ * previous block's footer leads back to a header of that size and the next
+ * block's header leads on to a footer of its size. A stray offset into the
+ * middle of a block would have to forge all three to pass
+ */
+static t_block *shm_block_at(t_zone *zone, void *ptr)
+{
+    t_block *block;
+    t_block *next;
+    char    *first;
+    char    *end;
+    size_t  prev_size;
+
+    first = (char *)ZONE_FIRST(zone);
+    end = (char *)zone + zone->zone_size;
+    block = BLOCK_FROM_PTR(ptr);
+    if ((size_t)((char *)block - first) % BLOCK_GRAIN != 0 ||
+        !shm_tag_ok(block, first, end) || block->is_free)
+        return NULL;
+    if ((char *)block > first)
+    {
+        prev_size = ((t_footer *)block)[-1];
+        if (prev_size > (size_t)((char *)block - first) ||
+            !shm_tag_ok((t_block *)((char *)block - prev_size), first, end) ||
+            ((t_block *)((char *)block - prev_size))->size != prev_size)
+            return NULL;
+    }
+    next = next_in_zone(zone, block);
+    if (next && !shm_tag_ok(next, first, end))
+        return NULL;
+    return block;
+}
+
+
+/*
+ * free an offset returned by shm_malloc, from any process; offsets that do
+ * not name a live block are ignored
+ */
+void shm_free(t_shm_heap *heap, t_shm_off offset)
+{
+    t_zone  *zone;
+    t_block *block;
+
+    if (!heap || offset < sizeof(t_block) || offset >= heap->size)
+        return;
+    if (shm_lock(heap) != 0)
+        return;
+
+    zone = shm_zone(heap);
+    block = shm_block_at(zone, (char *)heap->base + offset);
+    if (block)
+    {
+        block->is_free = 1;
+        zone->free_blocks++;
+        merge_free_blocks(zone, block);
+    }
+    pthread_mutex_unlock(&heap->base->mutex);
+}
+
+
+/* local address of an offset in this process's mapping, NULL for 0 */
+void *shm_ptr(t_shm_heap *heap, t_shm_off offset)
+{
+    if (!heap || !offset || offset >= heap->size)
+        return NULL;
+    return ((char *)heap->base + offset);
+}
+
+
+/* offset of a local address inside the mapping, 0 if outside */
+t_shm_off shm_offset(t_shm_heap *heap, void *ptr)
+{
+    if (!heap || (char *)ptr <= (char *)heap->base ||
+        (char *)ptr >= (char *)heap->base + heap->size)
+        return 0;
+    return ((char *)ptr - (char *)heap->base);
+}
+
+
+/* publish one object for the other processes to find, 0 clears it */
+int shm_set_root(t_shm_heap *heap, t_shm_off offset)
+{
+    if (!heap || shm_lock(heap) != 0)
+        return -1;
+    heap->base->root = offset;
+    pthread_mutex_unlock(&heap->base->mutex);
+    return 0;
+}
+
+
+/* the object last published with shm_set_root, 0 if none */
+t_shm_off shm_get_root(t_shm_heap *heap)
+{
+    t_shm_off   offset;
+
+    if (!heap || shm_lock(heap) != 0)
+        return 0;
+    offset = heap->base->root;
+    pthread_mutex_unlock(&heap->base->mutex);
+    return offset;
+}
@@ -28,6 +28,8 @@ size_t print_zone(t_zone *zone, t_zone_type zone_type)
         printf("TINY : %p\n", (void *)zone);
     else if (zone_type == SMALL)
         printf("SMALL : %p\n", (void *)zone);
+    else if (zone_type == MEDIUM)
+        printf("MEDIUM : %p\n", (void *)zone);
     else
         printf("LARGE : %p\n", (void *)zone);
 
@@ -61,20 +63,21 @@ size_t print_zone(t_zone *zone, t_zone_type zone_type)
 
 
 /*
- *  show memory allocation information
+ * print every zone of one state, returns the bytes in use
  */
-void show_alloc_mem(void)
+static size_t show_state(t_malloc_state *state)
 {
     t_zone  *zone;
     size_t  total_bytes;
+    size_t  cursor;
 
     /* locking for thread safety */
-    pthread_mutex_lock(&g_malloc_state.mutex);
+    malloc_lock(&state->lock);
 
     total_bytes = 0;
 
     /* print tiny zones */
-    zone = g_malloc_state.tiny_zones;
+    zone = state->tiny_zones;
     while (zone)
     {
         total_bytes += print_zone(zone, TINY);
@@ -82,25 +85,60 @@ void show_alloc_mem(void)
     }
 
     /* print SMALL zones */
-    zone = g_malloc_state.small_zones;
+    zone = state->small_zones;
     while (zone)
     {
         total_bytes += print_zone(zone, SMALL);
         zone = zone->next;
     }
 
-    /* print LARGE zones */
-    zone= g_malloc_state.large_zones;
+    /* print MEDIUM chunks */
+    zone = state->medium_zones;
+    while (zone)
+    {
+        total_bytes += print_zone(zone, MEDIUM);
+        zone = zone->next;
+    }
+
+    /* print LARGE zones, registered ones first */
+    large_walk_begin(state);
+    cursor = 0;
+    while ((zone = large_next(state, &cursor)))
+        total_bytes += print_zone(zone, LARGE);
+    large_walk_end(state);
+
+    zone= state->large_zones;
     while (zone) 
     {
         total_bytes += print_zone(zone, LARGE);
         zone = zone->next;
     }
 
-    /* print total allocated zones */
-    printf("Total: %zu \n", total_bytes);
-
     /* unlock mutex */
-    pthread_mutex_unlock(&g_malloc_state.mutex);
+    malloc_unlock(&state->lock);
+    return total_bytes;
+}
 
+
+/*
+ *  show memory allocation information, every NUMA node arena in turn,
+ *  then the object pools
+ */
+void show_alloc_mem(void)
+{
+    t_malloc_state  *arena;
+    size_t          total_bytes;
+    int             node;
+
+    total_bytes = show_state(&g_malloc_state);
+    for (node = 1; node < NUMA_MAX_NODES; node++)
+    {
+        arena = numa_arena_at(node);
+        if (arena)
+            total_bytes += show_state(arena);
+    }
+    total_bytes += show_pools();
+
+    /* print total allocated zones */
+    printf("Total: %zu \n", total_bytes);
 }
@@ -0,0 +1,112 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   stats.c                                            :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+extern t_malloc_state g_malloc_state;
+
+/*
+ * copy the lock statistics of a heap (NULL for the global state);
+ * returns -1 when the library was built without MALLOC_LOCK_STATS
+ */
+int malloc_lock_stats(t_heap *heap, t_lock_stats *stats)
+{
+#ifdef MALLOC_LOCK_STATS
+    t_malloc_state  *state;
+
+    state = heap ? heap : &g_malloc_state;
+    malloc_lock(&state->lock);
+    *stats = state->lock.stats;
+    malloc_unlock(&state->lock);
+    return 0;
+#else
+    (void)heap;
+    (void)stats;
+    return -1;
+#endif
+}
+
+
+/*
+ * print one lock's statistics as key=value lines
+ */
+static void print_lock_stats(const char *name, t_lock_stats *stats)
+{
+    int i;
+
+    printf("lock.%s.acquisitions=%lu\n", name, (unsigned long)stats->acquisitions);
+    printf("lock.%s.contended=%lu\n", name, (unsigned long)stats->contended);
+    printf("lock.%s.spin_acquired=%lu\n", name, (unsigned long)stats->spin_acquired);
+    printf("lock.%s.total_wait_ns=%lu\n", name, (unsigned long)stats->total_wait_ns);
+    printf("lock.%s.max_wait_ns=%lu\n", name, (unsigned long)stats->max_wait_ns);
+    for (i = 0; i < LOCK_STAT_BUCKETS; i++)
+    {
+        if (stats->buckets[i])
+            printf("lock.%s.wait_log2_ns.%d=%lu\n", name, i, (unsigned long)stats->buckets[i]);
+    }
+}
+
+
+/*
+ *  show allocator statistics
+ */
+void show_malloc_stats(void)
+{
+    t_lock_stats        stats;
+    t_numa_stats        numa;
+    t_background_stats  background;
+    t_pressure_stats    pressure;
+    t_lifetime_stats    lifetime;
+    int                 node;
+
+    if (malloc_lock_stats(NULL, &stats) == 0)
+        print_lock_stats("global", &stats);
+    else
+        printf("lock statistics not compiled in (build with LOCKSTATS=1)\n");
+
+    malloc_numa_stats(&numa);
+    printf("numa.nodes=%d\n", numa.nodes);
+    for (node = 0; node < numa.nodes; node++)
+    {
+        printf("numa.node.%d.zones_bound=%zu\n", node, numa.zones_bound[node]);
+        printf("numa.node.%d.bind_failed=%zu\n", node, numa.bind_failed[node]);
+        printf("numa.node.%d.zones_local=%zu\n", node, numa.zones_local[node]);
+        printf("numa.node.%d.zones_remote=%zu\n", node, numa.zones_remote[node]);
+    }
+
+    malloc_background_stats(&background);
+    printf("background.enabled=%d\n", background.enabled);
+    printf("background.running=%d\n", background.running);
+    printf("background.zones_prepared=%zu\n", background.zones_prepared);
+    printf("background.zones_ready=%zu\n", background.zones_ready);
+    printf("background.purged_bytes=%zu\n", background.purged_bytes);
+    printf("background.large_trimmed=%zu\n", background.large_trimmed);
+
+    malloc_pressure_stats(&pressure);
+    printf("pressure.level=%d\n", pressure.level);
+    printf("pressure.current=%zu\n", pressure.current);
+    printf("pressure.limit=%zu\n", pressure.limit);
+    printf("pressure.psi_some_avg10=%d\n", pressure.psi_some_avg10);
+    printf("pressure.polls=%zu\n", pressure.polls);
+    printf("pressure.shrinks=%zu\n", pressure.shrinks);
+    printf("pressure.released_bytes=%zu\n", pressure.released_bytes);
+
+    malloc_lifetime_stats(&lifetime);
+    printf("lifetime.predicting=%d\n", lifetime.predicting);
+    printf("lifetime.samples=%zu\n", lifetime.samples);
+    printf("lifetime.sites=%zu\n", lifetime.sites);
+    printf("lifetime.sites_short=%zu\n", lifetime.sites_short);
+    printf("lifetime.sites_long=%zu\n", lifetime.sites_long);
+    printf("lifetime.zones.default=%zu\n", lifetime.zones[LIFETIME_DEFAULT]);
+    printf("lifetime.zones.short=%zu\n", lifetime.zones[LIFETIME_SHORT]);
+    printf("lifetime.zones.long=%zu\n", lifetime.zones[LIFETIME_LONG]);
+}
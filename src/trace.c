@@ -0,0 +1,330 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   trace.c                                            :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+
+#ifdef MALLOC_TRACE
+
+# include <fcntl.h>
+# include <time.h>
+# include <sys/syscall.h>
+
+/*
+ * threads that may trace at once; the rings are remembered to remove them
+ * at exit. a thread's ring is removed, and its slot freed, when it exits
+ */
+# define TRACE_MAX_RINGS 256
+# define RING_CLAIMED ((t_trace_ring *)1)
+
+int                         g_trace_enabled = 0;
+static const char           *g_trace_dir = "/dev/shm";
+static int                  g_trace_keep = 0;
+static t_trace_ring         *g_rings[TRACE_MAX_RINGS];
+static unsigned int         g_ring_count = 0;   // slots ever used, a bound for walks
+static pthread_key_t        g_ring_key;
+static pthread_once_t       g_ring_once = PTHREAD_ONCE_INIT;
+static __thread t_trace_ring *t_ring = NULL;
+static __thread unsigned int t_ring_slot = 0;
+static __thread int         t_ring_failed = 0;
+
+
+/* timestamp counter, or monotonic nanoseconds where there is none */
+uint64_t trace_clock(void)
+{
+# if defined(__x86_64__) || defined(__i386__)
+    return (__builtin_ia32_rdtsc());
+# else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+# endif
+}
+
+
+/* append a decimal number to buf, returns the new length */
+static size_t append_num(char *buf, size_t len, unsigned long num)
+{
+    char    digits[24];
+    int     count;
+
+    count = 0;
+    do
+    {
+        digits[count++] = '0' + (num % 10);
+        num /= 10;
+    } while (num > 0);
+
+    while (count > 0)
+        buf[len++] = digits[--count];
+    return len;
+}
+
+
+/* <dir>/ft_malloc_trace.<pid>.<tid> */
+static void ring_path(char *path, size_t size, unsigned long pid, unsigned long tid)
+{
+    size_t  len;
+
+    len = append_str(path, 0, size - 48, g_trace_dir);
+    len = append_str(path, len, size, "/ft_malloc_trace.");
+    len = append_num(path, len, pid);
+    path[len++] = '.';
+    len = append_num(path, len, tid);
+    path[len] = '\0';
+}
+
+
+/* a ring published in a slot, NULL for a free or just claimed one */
+static t_trace_ring *ring_at(unsigned int index)
+{
+    t_trace_ring    *ring;
+
+    ring = __atomic_load_n(&g_rings[index], __ATOMIC_ACQUIRE);
+    return (ring == RING_CLAIMED ? NULL : ring);
+}
+
+
+/* claim a free slot, TRACE_MAX_RINGS if every one is taken */
+static unsigned int claim_slot(void)
+{
+    t_trace_ring    *expected;
+    unsigned int    count;
+    unsigned int    index;
+
+    for (index = 0; index < TRACE_MAX_RINGS; index++)
+    {
+        expected = NULL;
+        if (__atomic_load_n(&g_rings[index], __ATOMIC_RELAXED) == NULL &&
+            __atomic_compare_exchange_n(&g_rings[index], &expected, RING_CLAIMED,
+                false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    count = __atomic_load_n(&g_ring_count, __ATOMIC_RELAXED);
+    while (index < TRACE_MAX_RINGS && count <= index)
+    {
+        if (__atomic_compare_exchange_n(&g_ring_count, &count, index + 1,
+                false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            break;
+    }
+    return index;
+}
+
+
+/* remove a ring's file unless it is to be kept, and unmap it */
+static void drop_ring(t_trace_ring *ring, bool unmap)
+{
+    char    path[256];
+
+    if (!g_trace_keep)
+    {
+        ring_path(path, sizeof(path), ring->pid, ring->tid);
+        unlink(path);
+    }
+    if (unmap)
+        munmap(ring, TRACE_RING_BYTES);
+}
+
+
+/*
+ * thread exit: remove the ring and free its slot. allocations made by
+ * later destructors of the thread are not traced
+ */
+static void ring_thread_exit(void *unused)
+{
+    (void)unused;
+    if (!t_ring)
+        return;
+    __atomic_store_n(&g_rings[t_ring_slot], NULL, __ATOMIC_RELEASE);
+    drop_ring(t_ring, true);
+    t_ring = NULL;
+    t_ring_failed = 1;
+}
+
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&g_ring_key, ring_thread_exit);
+}
+
+
+/*
+ * create this thread's ring file, without going through malloc. with
+ * TRACE_MAX_RINGS threads already tracing, new ones do not
+ */
+static t_trace_ring *create_ring(void)
+{
+    char            path[256];
+    unsigned int    index;
+    pid_t           tid;
+    int             fd;
+    t_trace_ring    *ring;
+
+    index = claim_slot();
+    if (index >= TRACE_MAX_RINGS)
+        return NULL;
+
+    tid = (pid_t)syscall(SYS_gettid);
+    ring_path(path, sizeof(path), (unsigned long)getpid(), (unsigned long)tid);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    ring = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, TRACE_RING_BYTES) == 0)
+        ring = mmap(NULL, TRACE_RING_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    if (ring == MAP_FAILED)
+    {
+        if (fd >= 0)
+            unlink(path);
+        __atomic_store_n(&g_rings[index], NULL, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    ring->version = TRACE_VERSION;
+    ring->capacity = TRACE_RING_RECORDS;
+    ring->head = 0;
+    ring->pid = (uint32_t)getpid();
+    ring->tid = (uint32_t)tid;
+    __atomic_store_n(&ring->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_rings[index], ring, __ATOMIC_RELEASE);
+    t_ring_slot = index;
+    return ring;
+}
+
+
+/*
+ * write one record into this thread's ring; start is the trace_clock()
+ * value taken when the event began
+ */
+void trace_record(t_trace_event type, uint64_t size, uint64_t start)
+{
+    t_trace_record  *record;
+    uint64_t        now;
+    uint64_t        head;
+
+    now = trace_clock();
+    if (!t_ring)
+    {
+        if (t_ring_failed)
+            return;
+        t_ring = create_ring();
+        if (!t_ring)
+        {
+            t_ring_failed = 1;
+            return;
+        }
+        /* set once the ring is in place: it may allocate, and be traced */
+        pthread_once(&g_ring_once, ring_key_create);
+        pthread_setspecific(g_ring_key, t_ring);
+    }
+
+    head = t_ring->head;
+    record = &t_ring->records[head % TRACE_RING_RECORDS];
+    record->tsc = now;
+    record->type = type;
+    record->tid = t_ring->tid;
+    record->size = size;
+    record->duration = start ? now - start : 0;
+    __atomic_store_n(&t_ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * read FT_MALLOC_TRACE / FT_MALLOC_TRACE_DIR / FT_MALLOC_TRACE_KEEP, called
+ * once from malloc_init
+ */
+void trace_init(void)
+{
+    const char  *value;
+
+    value = getenv("FT_MALLOC_TRACE_DIR");
+    if (value && *value)
+        g_trace_dir = value;
+    value = getenv("FT_MALLOC_TRACE");
+    if (value && *value == '1')
+        g_trace_enabled = 1;
+    value = getenv("FT_MALLOC_TRACE_KEEP");
+    if (value && value[0] == '1' && !value[1])
+        g_trace_keep = 1;
+}
+
+
+/*
+ * fork child: the inherited rings are shared mappings of the parent's
+ * files, so drop them and let the child create its own on first use
+ */
+void trace_atfork_child(void)
+{
+    unsigned int    count;
+    unsigned int    i;
+
+    count = g_ring_count;
+    for (i = 0; i < count; i++)
+    {
+        if (ring_at(i))
+            munmap(g_rings[i], TRACE_RING_BYTES);
+        g_rings[i] = NULL;
+    }
+    g_ring_count = 0;
+    t_ring = NULL;
+    t_ring_failed = 0;
+}
+
+
+/* remove the ring files of this process as it exits */
+__attribute__((destructor))
+static void trace_shutdown(void)
+{
+    t_trace_ring    *ring;
+    unsigned int    count;
+    unsigned int    i;
+
+    if (g_trace_keep)
+        return;
+    count = __atomic_load_n(&g_ring_count, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count; i++)
+    {
+        ring = ring_at(i);
+        if (ring)
+            drop_ring(ring, false);
+    }
+}
+
+
+/* switch tracing on or off at run time, returns the previous state */
+int malloc_trace_enable(int on)
+{
+    int previous;
+
+    previous = g_trace_enabled;
+    g_trace_enabled = on ? 1 : 0;
+    return previous;
+}
+
+#else
+
+void trace_init(void)
+{
+}
+
+void trace_atfork_child(void)
+{
+}
+
+/* tracing is not compiled in */
+int malloc_trace_enable(int on)
+{
+    (void)on;
+    return -1;
+}
+
+#endif
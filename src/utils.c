@@ -0,0 +1,76 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   utils.c                                            :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../inc/malloc.h"
+#include <time.h>
+
+/*
+ * small helpers shared by the allocator's files, in place of libc string
+ * functions and of stdio, which may allocate
+ */
+
+
+/* copy size bytes between buffers that do not overlap */
+void ft_memcpy(void *dst, const void *src, size_t size)
+{
+    ft_memmove_down(dst, src, size);
+}
+
+
+/* move size bytes from src down to a lower, possibly overlapping, dst */
+void ft_memmove_down(void *dst, const void *src, size_t size)
+{
+    size_t      i;
+    char        *d;
+    const char  *s;
+
+    d = (char *)dst;
+    s = (const char *)src;
+    i = 0;
+    while (i < size)
+    {
+        d[i] = s[i];
+        i++;
+    }
+}
+
+
+/* zero size bytes */
+void ft_bzero(void *dst, size_t size)
+{
+    size_t  i;
+    char    *d;
+
+    d = (char *)dst;
+    for (i = 0; i < size; i++)
+        d[i] = 0;
+}
+
+
+/* append a string to buf, keeping it terminated; returns the new length */
+size_t append_str(char *buf, size_t len, size_t cap, const char *str)
+{
+    while (*str && len < cap - 1)
+        buf[len++] = *str++;
+    buf[len] = '\0';
+    return len;
+}
+
+
+/* milliseconds on the monotonic clock */
+uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+}
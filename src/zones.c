@@ -12,7 +12,9 @@
 
 #include "../inc/malloc.h"
 
-extern t_malloc_state g_malloc_state;
+/* the bootstrap zones, see BOOTSTRAP_ALIGN */
+static char g_bootstrap_tiny[BOOTSTRAP_TINY_SIZE] __attribute__((aligned(BOOTSTRAP_ALIGN)));
+static char g_bootstrap_small[BOOTSTRAP_SMALL_SIZE] __attribute__((aligned(BOOTSTRAP_ALIGN)));
 
 
 /*
@@ -23,37 +25,46 @@ size_t get_user_size(t_block *block)
     return (block->size - sizeof(t_block) - sizeof(t_footer));
 }
 
-/* create a new zone of the specified type with at least the given size */
-t_zone *create_zone(t_zone_type zone_type, size_t size)
+/*
+ * total mapping size of a zone of the given type holding size bytes
+ */
+size_t zone_size_for(t_zone_type zone_type, size_t size)
 {
-    t_zone  *zone;
-    size_t  zone_size;
-    t_block *block;
-    t_footer *footer;
-
-    /* determine zone size based on type */
     if (zone_type == TINY)
-        zone_size = TINY_ZONE;
+        return (TINY_ZONE);
     else if (zone_type == SMALL)
-        zone_size = SMALL_ZONE;
-    else // large
-        zone_size = ALIGN(sizeof(t_zone) + BLOCK_SIZE(size));
+        return (SMALL_ZONE);
+    else if (zone_type == MEDIUM)
+        return (MEDIUM_ZONE);
+    return (ALIGN(ZONE_HEADER_SIZE + BLOCK_SIZE(size)));
+}
 
-    /* map memory for the zone */
-    zone = mmap(NULL, zone_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (zone == MAP_FAILED)
-        return NULL;
+
+/*
+ * (re)initialize a mapped zone: header plus one free block spanning it
+ */
+void init_zone(t_zone *zone, t_zone_type zone_type, size_t zone_size)
+{
+    t_block *block;
+    t_footer *footer;
 
     /* initialize zone header */
     zone->zone_size = zone_size;
     zone->zone_type = zone_type;
     zone->free_blocks = 1;
+    zone->decommitted = 0;
+    zone->lifetime = LIFETIME_DEFAULT;
     zone->next = NULL;
 
+    /* a fresh mapping reads 0 here; a reused zone keeps what it had */
+    if (zone->dirty < ZONE_HEADER_SIZE + sizeof(t_block))
+        zone->dirty = ZONE_HEADER_SIZE + sizeof(t_block);
+
     /* initialize the first (and only) block in the zone */
-    block = (t_block *)((char *)zone + sizeof(t_zone));
-    block->size = zone_size - sizeof(t_zone);
+    block = (t_block *)((char *)zone + ZONE_HEADER_SIZE);
+    block->size = zone_size - ZONE_HEADER_SIZE;
     block->is_free = 1;
+    block->grow_hint = 0;
     block->next = NULL;
 
     /* set up footer */
@@ -62,22 +73,127 @@ t_zone *create_zone(t_zone_type zone_type, size_t size)
 
     /* set first block pointer */
     zone->first = block;
+}
+
+
+/*
+ * link the static bootstrap zones into a (fresh) state; called once, from
+ * malloc_init, for the global state only
+ */
+void bootstrap_zones(t_malloc_state *state)
+{
+    const char  *value;
+    t_zone      *tiny;
+    t_zone      *small;
+
+    value = getenv("FT_MALLOC_BOOTSTRAP");
+    if ((value && value[0] == '0' && !value[1]) || getpagesize() > BOOTSTRAP_ALIGN)
+        return;
+
+    tiny = (t_zone *)g_bootstrap_tiny;
+    small = (t_zone *)g_bootstrap_small;
+    init_zone(tiny, TINY, BOOTSTRAP_TINY_SIZE);
+    init_zone(small, SMALL, BOOTSTRAP_SMALL_SIZE);
+    tiny->next = state->tiny_zones;
+    state->tiny_zones = tiny;
+    small->next = state->small_zones;
+    state->small_zones = small;
+}
+
+
+/* true for the static bootstrap zones, which must never be unmapped */
+bool zone_is_bootstrap(t_zone *zone)
+{
+    return ((char *)zone == g_bootstrap_tiny || (char *)zone == g_bootstrap_small);
+}
+
+
+/*
+ * map and initialize a zone of the specified type with at least the given
+ * size, placed on a NUMA node (-1 = anywhere); the zone is not linked into
+ * any list
+ */
+t_zone *map_zone(t_zone_type zone_type, size_t size, int node)
+{
+    t_zone  *zone;
+    size_t  zone_size;
+
+    /* every new zone is a chance to catch a thread the build cannot handle */
+    lock_check_threads();
+
+    /* the arena count is settled before the first zone is placed */
+    numa_resolve();
+
+    /* determine zone size based on type */
+    zone_size = zone_size_for(zone_type, size);
+
+    /* map memory for the zone */
+    TRACE_START(start);
+    zone = mmap(NULL, zone_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (zone == MAP_FAILED)
+        return NULL;
+    TRACE_END(TRACE_ZONE_CREATE, zone_size, start);
+    pressure_note_mapping();
+
+    /*
+     * bind before the first touch so the pages are faulted on the node,
+     * and tell free who owns them: a LARGE block starts in the first page
+     */
+    numa_bind(zone, zone_size, node);
+    if (!numa_mark(zone, zone_type == LARGE ? OWNER_GRANULE : zone_size, node))
+    {
+        munmap(zone, zone_size);
+        return NULL;
+    }
+    init_zone(zone, zone_type, zone_size);
+    return zone;
+}
+
+
+/* create a new zone of the specified type with at least the given size */
+t_zone *create_zone(t_malloc_state *state, t_zone_type zone_type, size_t size)
+{
+    t_zone  *zone;
+
+    zone = NULL;
+    if (zone_type == TINY || zone_type == SMALL)
+    {
+        /* bounded-latency threads never map on the allocation path */
+        if (thread_reserve_only())
+            zone = reserve_take_zone(state, zone_type);
+
+        /* then a zone pre-faulted by the background thread, if any */
+        if (!zone)
+            zone = ready_take_zone(state, zone_type);
+        background_wake();
+        if (!zone && thread_reserve_only())
+            return NULL;
+    }
+    if (!zone)
+        zone = map_zone(zone_type, size, state->node);
+    if (!zone)
+        return NULL;
 
     /* add to appropriate zone list based on type */
     if (zone_type == TINY)
     {
-        zone->next = g_malloc_state.tiny_zones;
-        g_malloc_state.tiny_zones = zone;
+        zone->next = state->tiny_zones;
+        state->tiny_zones = zone;
     }
     else if (zone_type == SMALL)
     {
-        zone->next = g_malloc_state.small_zones;
-        g_malloc_state.small_zones = zone;
+        zone->next = state->small_zones;
+        state->small_zones = zone;
+    }
+    else if (zone_type == MEDIUM)
+    {
+        zone->next = state->medium_zones;
+        state->medium_zones = zone;
     }
     else // large
     {
-        zone->next = g_malloc_state.large_zones;
-        g_malloc_state.large_zones = zone;
+        zone->next = state->large_zones;
+        state->large_zones = zone;
     }
 
     return zone;
@@ -86,28 +202,44 @@ t_zone *create_zone(t_zone_type zone_type, size_t size)
 
 
 /* 
- * find a zone with enough free space for the specified size
+ * find a zone of the given lifetime class with enough free space for the
+ * specified size; an empty zone of another class is taken over, except the
+ * bootstrap zones, which stay LIFETIME_DEFAULT
  */
-t_zone *find_zone_with_space(size_t size, t_zone_type zone_type)
+t_zone *find_zone_with_space(t_malloc_state *state, size_t size, t_zone_type zone_type,
+            uint32_t lifetime)
 {
     t_zone      *zone;
     t_block     *block;
 
     // select zone list based on type
     if (zone_type == TINY)
-        zone = g_malloc_state.tiny_zones;
+        zone = state->tiny_zones;
     else if (zone_type == SMALL)
-        zone = g_malloc_state.small_zones;
+        zone = state->small_zones;
     else
-        zone = g_malloc_state.large_zones;
+        zone = state->large_zones;
 
     // seacrching through the zones of the specified type
     while (zone)
     {
+        // zones of other lifetimes are skipped unless nothing lives in them
+        block = ZONE_FIRST(zone);
+        if (zone->lifetime != lifetime &&
+            (!(block->is_free && block->size == zone->zone_size - ZONE_HEADER_SIZE) ||
+            zone_is_bootstrap(zone)))
+        {
+            zone = zone->next;
+            continue;
+        }
+
         // check if this zone has a suitable free block
         block = find_free_block(zone, size);
         if (block)
+        {
+            zone->lifetime = lifetime;
             return zone;
+        }
 
         zone = zone->next;
     }
@@ -124,7 +256,7 @@ t_block *find_free_block(t_zone *zone, size_t size)
 {
     t_block     *block;
 
-    block = zone->first;
+    block = ZONE_FIRST(zone);
     while (block)
     {
         if (block->is_free && block->size >= size)
@@ -142,9 +274,60 @@ t_block *find_free_block(t_zone *zone, size_t size)
 
 
 /*
- * split a block if its larger than needed
+ * get the physically next block, or NULL at the end of the zone
+ */
+t_block *next_in_zone(t_zone *zone, t_block *block)
+{
+    if ((char *)block + block->size < (char *)zone + zone->zone_size)
+        return ((t_block *)((char *)block + block->size));
+    return NULL;
+}
+
+
+/*
+ * get the physically previous block through its footer, or NULL
+ */
+t_block *prev_in_zone(t_zone *zone, t_block *block)
+{
+    t_footer    *prev_footer;
+
+    if ((char *)block <= (char *)ZONE_FIRST(zone))
+        return NULL;
+
+    // use boundary tag to find previous block's size
+    prev_footer = (t_footer *)((char *)block - sizeof(t_footer));
+    return ((t_block *)((char *)block - *prev_footer));
+}
+
+
+/*
+ * absorb the physically next block into this one if it is free
+ */
+static void absorb_next_free(t_zone *zone, t_block *block)
+{
+    t_block     *next_block;
+    t_footer    *footer;
+
+    next_block = next_in_zone(zone, block);
+    if (!next_block || !next_block->is_free)
+        return;
+
+    block->size += next_block->size;
+
+    // update footer
+    footer = FOOTER(block);
+    *footer = block->size;
+
+    // decrease free block count as we merged two blocks
+    zone->free_blocks--;
+}
+
+
+/*
+ * split a block if its larger than needed; the free remainder is
+ * coalesced with a free block that follows it
  */
-t_block *split_block(t_block *block, size_t size)
+t_block *split_block(t_zone *zone, t_block *block, size_t size)
 {
     t_block     *new_block;
     t_footer    *footer;
@@ -166,14 +349,15 @@ t_block *split_block(t_block *block, size_t size)
     new_block = (t_block *)((char *)block + size);
     new_block->size = remaining_size;
     new_block->is_free = 1;
+    new_block->grow_hint = 0;
 
     // set up footer for new block
     footer = FOOTER(new_block);
     *footer = remaining_size;
 
-    // update next pointers
-    new_block->next = block->next;
-    block->next = new_block;
+    // the remainder is a new free block
+    zone->free_blocks++;
+    absorb_next_free(zone, new_block);
 
     return block;
 }
@@ -181,55 +365,32 @@ t_block *split_block(t_block *block, size_t size)
 
 
 /*
- * merge adjacent free block
+ * merge a free block with its free neighbours, returns the merged block
  */
-void merge_free_blocks(t_zone *zone, t_block *block)
+t_block *merge_free_blocks(t_zone *zone, t_block *block)
 {
-    t_block     *next_block;
-    t_footer    *footer;
     t_block     *prev_block;
-    t_footer     *prev_footer;
-
-    //check if there's a next block to potentially merge with
-    if ((char *)block + block->size < (char *)zone + zone->zone_size)
-    {
-        next_block = (t_block *)((char *)block + block->size);
-        if (next_block->is_free)
-        {
-            // merge with next block
-            block->size += next_block->size;
-            block->next = next_block->next;
-
-            // update footer
-            footer = FOOTER(block);
-            *footer = block->size;
+    t_footer    *footer;
 
-            // dcerease free block count as we merged two blocks
-            zone->free_blocks--;
-        }
-    }
+    //merge with the next block if it is free
+    absorb_next_free(zone, block);
 
     // check if there's a previous block to potentially merge with
-    if ((char *)block > (char *)zone->first)
+    prev_block = prev_in_zone(zone, block);
+    if (prev_block && prev_block->is_free)
     {
-        // use boundary tag to find previous block's size
-        prev_footer = (t_footer *)((char *)block - sizeof(t_footer));
-        prev_block = (t_block *)((char *)block - *prev_footer);
-
-        if (prev_block->is_free)
-        {
-            // merge with previous block
-            prev_block->size += block->size;
-            prev_block->next = block->next;
+        // merge with previous block
+        prev_block->size += block->size;
 
-            // update footer
-            footer = FOOTER(prev_block);
-            *footer = prev_block->size;
+        // update footer
+        footer = FOOTER(prev_block);
+        *footer = prev_block->size;
 
-            // decrease free block count as we merged two blocks
-            zone->free_blocks--;
-        }
+        // decrease free block count as we merged two blocks
+        zone->free_blocks--;
+        block = prev_block;
     }
+    return block;
 }
 
 
@@ -237,45 +398,50 @@ void merge_free_blocks(t_zone *zone, t_block *block)
 
 
 /*
- * check if a block can be extended
+ * try to grow an allocated block in place to new_size, staying inside its
+ * zone: first into a free next block, then also into a free previous block
+ * (moving the data down). returns the resulting block or NULL
  */
-
-bool try_extend_block(t_block *block, size_t new_size)
+t_block *try_extend_block(t_zone *zone, t_block *block, size_t new_size)
 {
     t_block     *next_block;
-    size_t      combined_size;
+    t_block     *prev_block;
+    size_t      next_size;
+    size_t      user_size;
     t_footer    *footer;
 
-    // check if there's a new block
-    next_block = (t_block *)((char *)block + block->size);
+    next_block = next_in_zone(zone, block);
+    next_size = (next_block && next_block->is_free) ? next_block->size : 0;
 
-    // if next block exists and is free
-    if (next_block && next_block->is_free)
+    // forward: the free next block alone is enough
+    if (block->size + next_size >= new_size)
     {
-        combined_size = block->size +next_block->size;
-
-        // if combined size is enough
-        if (combined_size >= new_size)
-        {
-            // merge with next block
-            block->size = combined_size;
-            block->next = next_block->next;
-
-            // update footer
-            footer = FOOTER(block);
-            *footer = block->size;
-
-            // if resulting block is much larger than needed, split it
-            if (block->size > new_size + BLOCK_SIZE(1))
-                split_block(block, new_size);
+        absorb_next_free(zone, block);
+        split_block(zone, block, new_size);
+        zone_commit_block(zone, block);
+        return block;
+    }
 
+    // backward: merge into a free previous block and slide the data down
+    prev_block = prev_in_zone(zone, block);
+    if (!prev_block || !prev_block->is_free ||
+        prev_block->size + block->size + next_size < new_size)
+        return NULL;
 
-            return true;
-        }
-    }
-    return false;
-}
+    user_size = get_user_size(block);
+    absorb_next_free(zone, block);
 
+    prev_block->size += block->size;
+    prev_block->is_free = 0;
+    prev_block->grow_hint = block->grow_hint;
+    zone->free_blocks--;
 
+    footer = FOOTER(prev_block);
+    *footer = prev_block->size;
+    zone_commit_block(zone, prev_block);
 
+    ft_memmove_down(PTR_FROM_BLOCK(prev_block), PTR_FROM_BLOCK(block), user_size);
 
+    split_block(zone, prev_block, new_size);
+    return prev_block;
+}
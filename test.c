@@ -3,6 +3,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
 
 #define TINY_ALLOC_SIZE 64
 #define SMALL_ALLOC_SIZE 512
@@ -14,6 +20,26 @@ static void write_str(const char *str)
 }
 
 
+/*
+ * a SINGLE_THREADED=1 build aborts once a thread exists: tests that need
+ * one report themselves skipped
+ */
+#ifdef MALLOC_SINGLE_THREADED
+# define THREADS_ALLOWED 0
+#else
+# define THREADS_ALLOWED 1
+#endif
+
+static int threads_forbidden(const char *name)
+{
+    if (THREADS_ALLOWED)
+        return 0;
+    write_str(name);
+    write_str(": SUCCESS - skipped, threads abort a SINGLE_THREADED=1 build\n");
+    return 1;
+}
+
+
 static void write_num(int num)
 {
     char buffer[16];
@@ -98,12 +124,75 @@ void *thread_routine_with_helpers(void *arg)
     
 }
 
+static void *single_thread_routine(void *arg)
+{
+    (void)arg;
+    return (malloc(TINY_ALLOC_SIZE));
+}
+
+/*
+ * must run before any thread exists: allocator locks are skipped until
+ * the second thread starts, then taken again
+ */
+void test_single_threaded(void)
+{
+#ifdef MALLOC_SINGLE_THREADED
+    pthread_t   thread;
+    void        *from_thread;
+    pid_t       pid;
+    int         status;
+
+    /* locking is compiled out: a thread must abort the program */
+    pid = fork();
+    if (pid == 0)
+    {
+        close(STDERR_FILENO);
+        pthread_create(&thread, NULL, single_thread_routine, NULL);
+        pthread_join(thread, &from_thread);
+        free(malloc(TINY_ALLOC_SIZE));
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    if (malloc_single_threaded() && WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT)
+        write_str("Single thread: SUCCESS - adaptive mode not compiled in, a thread aborts\n");
+    else
+        write_str("Single thread: FAILED thread not caught by SINGLE_THREADED=1\n");
+#else
+    pthread_t   thread;
+    void        *ptrs[100];
+    void        *from_thread;
+    int         before;
+    int         i;
+    int         ok = 1;
+
+    before = malloc_single_threaded();
+    for (i = 0; i < 100; i++)
+        ptrs[i] = malloc(i % 2 ? TINY_ALLOC_SIZE : SMALL_ALLOC_SIZE);
+    pthread_create(&thread, NULL, single_thread_routine, NULL);
+
+    /* frees of blocks allocated without locks, now with them */
+    for (i = 0; i < 100; i++)
+        free(ptrs[i]);
+    pthread_join(thread, &from_thread);
+    if (!before || malloc_single_threaded() || !from_thread)
+        ok = 0;
+    free(from_thread);
+
+    if (ok)
+        write_str("Single thread: SUCCESS - locking skipped until a thread was created\n");
+    else
+        write_str("Single thread: FAILED locking mode not switched\n");
+#endif
+}
+
 void test_multithreaded(void) {
     
     pthread_t threads[5];
     int thread_ids[5];
     int i;
 
+    if (threads_forbidden("Multithreaded"))
+        return;
     for (i = 0; i < 5; i++)
     {
         thread_ids[i] = i;
@@ -127,10 +216,1462 @@ void test_multithreaded(void) {
 }
 
 
-int main(void) {
+void test_heaps(void)
+{
+    t_heap  *heap;
+    void    *ptrs[100];
+    int     i;
+    int     failures = 0;
+
+    heap = heap_create();
+    if (!heap)
+    {
+        write_str("Heap: failed to create heap\n");
+        return;
+    }
+
+    for (i = 0; i < 100; i++)
+    {
+        ptrs[i] = heap_malloc(heap, (i % 3 == 0) ? TINY_ALLOC_SIZE :
+                                    (i % 3 == 1) ? SMALL_ALLOC_SIZE :
+                                    LARGE_ALLOC_SIZE);
+        if (!ptrs[i])
+            failures++;
+        else
+            memset(ptrs[i], i, TINY_ALLOC_SIZE);
+    }
+
+    /* free a few individually, let heap_destroy sweep the rest */
+    for (i = 0; i < 100; i += 10)
+        heap_free(heap, ptrs[i]);
+
+    heap_destroy(heap);
+
+    if (failures == 0)
+        write_str("Heap: SUCCESS - 100 allocations released by heap_destroy\n");
+    else
+        write_str("Heap: FAILED allocations\n");
+}
+
+
+static volatile int fork_test_running = 1;
+
+static void *fork_churn_routine(void *arg)
+{
+    void *ptr;
+
+    (void)arg;
+    while (fork_test_running)
+    {
+        ptr = malloc(SMALL_ALLOC_SIZE);
+        free(ptr);
+    }
+    return NULL;
+}
+
+void test_fork_safety(void)
+{
+    pthread_t   threads[2];
+    pid_t       pid;
+    int         status;
+    int         i;
+    int         failures = 0;
+
+    if (threads_forbidden("Fork"))
+        return;
+    for (i = 0; i < 2; i++)
+        pthread_create(&threads[i], NULL, fork_churn_routine, NULL);
+
+    /* fork repeatedly while the other threads hold the allocator lock */
+    for (i = 0; i < 50; i++)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            void *ptr = malloc(TINY_ALLOC_SIZE);
+            free(ptr);
+            _exit(ptr ? 0 : 1);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+
+    fork_test_running = 0;
+    for (i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+
+    if (failures == 0)
+        write_str("Fork: SUCCESS - 50 children allocated after fork\n");
+    else
+        write_str("Fork: FAILED children\n");
+}
+
+
+#define REGISTRY_BATCH (LARGE_REGISTRY_SLOTS + 512)
+#define REGISTRY_ROUNDS 2
+#define REGISTRY_LOOKUPS 200000
+
+/* nanoseconds taken by REGISTRY_LOOKUPS lookups of a pointer */
+static long time_lookups(void *ptr)
+{
+    struct timespec start;
+    struct timespec end;
+    int             i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < REGISTRY_LOOKUPS; i++)
+        malloc_usable_size(ptr);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec);
+}
+
+void test_large_registry(void)
+{
+    static void *ptrs[REGISTRY_BATCH];
+    char        *page;
+    void        *miss;
+    long        before;
+    long        after;
+    size_t      size;
+    int         round;
+    int         i;
+    int         ok = 1;
+
+    /* looks like the block of a LARGE zone, but was never registered */
+    page = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED)
+        return;
+    miss = page + ZONE_HEADER_SIZE + sizeof(t_block);
+    before = time_lookups(miss);
+
+    /* more zones than slots at once: every slot ends up a tombstone */
+    for (round = 0; round < REGISTRY_ROUNDS; round++)
+    {
+        size = MEDIUM_MAX + (round + 1) * getpagesize();
+        for (i = 0; i < REGISTRY_BATCH; i++)
+            ptrs[i] = malloc(size);
+        for (i = 0; i < REGISTRY_BATCH; i++)
+        {
+            if (!ptrs[i] || malloc_usable_size(ptrs[i]) < size)
+                ok = 0;
+        }
+        for (i = 0; i < REGISTRY_BATCH; i++)
+            free(ptrs[i]);
+        if (malloc_usable_size(ptrs[0]) != 0)
+            ok = 0;
+    }
+
+    /* a miss still stops after a few slots, tombstones or not */
+    after = time_lookups(miss);
+    if (malloc_usable_size(miss) != 0 || after > before * 4 + 1000000)
+        ok = 0;
+    munmap(page, getpagesize());
+
+    if (ok)
+        write_str("Large registry: SUCCESS - lookups stay bounded after slot reuse\n");
+    else
+        write_str("Large registry: FAILED registry lookups wrong or slow\n");
+}
+
+
+/* stores here keep the compiler from eliding malloc/free pairs */
+static void *volatile g_keep;
+
+/* true if q's block starts right where p's block ends */
+static int adjacent(void *p, void *q)
+{
+    return ((uintptr_t)q - (uintptr_t)p ==
+        malloc_usable_size(p) + sizeof(t_block) + sizeof(t_footer));
+}
+
+void test_realloc_in_place(void)
+{
+    char    *guard;
+    char    *a;
+    char    *b;
+    char    *c;
+    char    *grown;
+    char    *skipped[16];
+    int     nskipped = 0;
+    int     i;
+    int     intact = 1;
+    uintptr_t   a_addr;
+
+    /*
+     * earlier allocations leave holes; take blocks until four in a row are
+     * neighbours (the guard keeps a from merging with a free predecessor)
+     */
+    guard = malloc(SMALL_ALLOC_SIZE / 2);
+    a = malloc(SMALL_ALLOC_SIZE / 2);
+    b = malloc(SMALL_ALLOC_SIZE / 2);
+    c = malloc(SMALL_ALLOC_SIZE / 2);
+    while (nskipped < 16 && !(adjacent(guard, a) && adjacent(a, b) && adjacent(b, c)))
+    {
+        skipped[nskipped++] = guard;
+        guard = a;
+        a = b;
+        b = c;
+        c = malloc(SMALL_ALLOC_SIZE / 2);
+    }
+    g_keep = a;
+    g_keep = c;
+    for (i = 0; i < SMALL_ALLOC_SIZE / 2; i++)
+        b[i] = (char)i;
+
+    /* b cannot grow forward (c is in the way), so it must slide into a */
+    a_addr = (uintptr_t)a;
+    free(a);
+    grown = realloc(b, SMALL_ALLOC_SIZE - 100);
+    for (i = 0; i < SMALL_ALLOC_SIZE / 2; i++)
+        if (grown[i] != (char)i)
+            intact = 0;
+    if ((uintptr_t)grown == a_addr && intact)
+        write_str("Realloc: SUCCESS - grew backward into free neighbour\n");
+    else
+        write_str("Realloc: FAILED backward growth\n");
+
+    /* crossing the SMALL ceiling moves the block to a bigger class */
+    grown = realloc(grown, LARGE_ALLOC_SIZE);
+    for (i = 0; i < SMALL_ALLOC_SIZE / 2; i++)
+        if (grown[i] != (char)i)
+            intact = 0;
+    if (grown && intact)
+        write_str("Realloc: SUCCESS - promoted out of SMALL with data intact\n");
+    else
+        write_str("Realloc: FAILED promotion\n");
+
+    free(grown);
+    free(c);
+    free(guard);
+    for (i = 0; i < nskipped; i++)
+        free(skipped[i]);
+}
+
+
+#define GROWTH_FINAL (300 * 1024)
+#define GROWTH_MOVES_MAX 16
+
+void test_realloc_growth(void)
+{
+    char    *buffer;
+    char    *grown;
+    size_t  usable;
+    size_t  size;
+    int     moves = 0;
+    int     ok = 1;
+
+    /* appending a byte at a time: headroom keeps the moves logarithmic */
+    buffer = NULL;
+    for (size = 1; size <= GROWTH_FINAL; size++)
+    {
+        grown = realloc(buffer, size);
+        if (!grown)
+        {
+            ok = 0;
+            break;
+        }
+        if (grown != buffer)
+            moves++;
+        buffer = grown;
+        buffer[size - 1] = (char)size;
+    }
+    if (moves > GROWTH_MOVES_MAX)
+        ok = 0;
+
+    /* the headroom is given back by an explicit trim, without moving */
+    usable = malloc_usable_size(buffer);
+    realloc_trim(buffer, GROWTH_FINAL);
+    if (usable <= GROWTH_FINAL || malloc_usable_size(buffer) >= usable ||
+        malloc_usable_size(buffer) < GROWTH_FINAL)
+        ok = 0;
+    for (size = 1; size <= GROWTH_FINAL && ok; size++)
+    {
+        if (buffer[size - 1] != (char)size)
+            ok = 0;
+    }
+    free(buffer);
+
+    if (ok)
+        write_str("Realloc growth: SUCCESS - few moves, headroom released by realloc_trim\n");
+    else
+        write_str("Realloc growth: FAILED too many moves or headroom kept\n");
+}
+
+
+/* ring file tracing writes for a thread, as named in inc/malloc_trace.h */
+static void trace_path(char *path, size_t size, long pid, long tid)
+{
+    const char  *dir;
+
+    dir = getenv("FT_MALLOC_TRACE_DIR");
+    snprintf(path, size, "%s/ft_malloc_trace.%ld.%ld", dir && *dir ? dir : "/dev/shm", pid, tid);
+}
+
+#define TRACE_THREADS 300
+
+static void *trace_thread_routine(void *arg)
+{
+    char    path[512];
+
+    g_keep = malloc(MEDIUM_MAX + 4096);
+    free(g_keep);
+    trace_path(path, sizeof(path), getpid(), syscall(SYS_gettid));
+    *(long *)arg = access(path, F_OK) == 0 ? syscall(SYS_gettid) : 0;
+    return NULL;
+}
+
+void test_trace(void)
+{
+    const t_trace_ring  *ring;
+    pthread_t           thread;
+    long                tid;
+    char                path[512];
+    uint64_t            i;
+    pid_t               pid;
+    int                 status;
+    int                 previous;
+    int                 allocs = 0;
+    int                 frees = 0;
+    int                 fd;
+    int                 ok = 1;
+
+    previous = malloc_trace_enable(1);
+    if (previous < 0)
+    {
+        write_str("Trace: SUCCESS - not compiled in (make TRACE=1)\n");
+        return;
+    }
+    g_keep = malloc(MEDIUM_MAX + 4096);
+    free(g_keep);
+    malloc_trace_enable(previous);
+
+    /* this thread's ring holds the LARGE allocation and its release */
+    trace_path(path, sizeof(path), getpid(), syscall(SYS_gettid));
+    fd = open(path, O_RDONLY);
+    ring = fd < 0 ? MAP_FAILED : mmap(NULL, TRACE_RING_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    if (ring == MAP_FAILED)
+        ok = 0;
+    else
+    {
+        if (ring->magic != TRACE_MAGIC || ring->pid != (uint32_t)getpid())
+            ok = 0;
+        for (i = 0; i < ring->head && i < ring->capacity; i++)
+        {
+            if (ring->records[i].tid != ring->tid)
+                ok = 0;
+            if (ring->records[i].type == TRACE_LARGE_ALLOC && ring->records[i].size > MEDIUM_MAX)
+                allocs++;
+            if (ring->records[i].type == TRACE_LARGE_FREE && allocs)
+                frees++;
+        }
+        munmap((void *)ring, TRACE_RING_BYTES);
+    }
+    if (!allocs || !frees)
+        ok = 0;
+
+    /* a thread that exits takes its ring with it, and frees its slot */
+    malloc_trace_enable(1);
+    for (i = 0; THREADS_ALLOWED && i < TRACE_THREADS; i++)
+    {
+        tid = 0;
+        pthread_create(&thread, NULL, trace_thread_routine, &tid);
+        pthread_join(thread, NULL);
+        trace_path(path, sizeof(path), getpid(), tid);
+        if (!tid || access(path, F_OK) == 0)
+            ok = 0;
+    }
+    malloc_trace_enable(previous);
+
+    /* a process that exits takes its rings with it */
+    pid = fork();
+    if (pid == 0)
+    {
+        malloc_trace_enable(1);
+        free(malloc(MEDIUM_MAX + 4096));
+        exit(0);
+    }
+    trace_path(path, sizeof(path), pid, pid);
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || access(path, F_OK) == 0)
+        ok = 0;
+
+    if (ok)
+        write_str("Trace: SUCCESS - events recorded in the ring, rings removed at thread and process exit\n");
+    else
+        write_str("Trace: FAILED ring missing, wrong or left behind\n");
+}
+
+
+#define CONTENTION_THREADS 4
+#define CONTENTION_ROUNDS 200000
+
+static t_heap *g_contended;
+
+static void *contention_routine(void *arg)
+{
+    void    *ptr;
+    int     i;
+
+    (void)arg;
+    for (i = 0; i < CONTENTION_ROUNDS; i++)
+    {
+        ptr = heap_malloc(g_contended, (i & 1) ? TINY_ALLOC_SIZE : SMALL_ALLOC_SIZE);
+        heap_free(g_contended, ptr);
+    }
+    return NULL;
+}
+
+void test_lock_stats(void)
+{
+    pthread_t       threads[CONTENTION_THREADS];
+    t_lock_stats    stats;
+    uint64_t        bucketed;
+    int             i;
+    int             ok = 1;
+
+    if (threads_forbidden("Lock stats"))
+        return;
+    /* a heap of its own, so only these threads show in its lock */
+    g_contended = heap_create();
+    if (!g_contended)
+        return;
+    for (i = 0; i < CONTENTION_THREADS; i++)
+        pthread_create(&threads[i], NULL, contention_routine, NULL);
+    for (i = 0; i < CONTENTION_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    if (malloc_lock_stats(g_contended, &stats) != 0)
+    {
+        heap_destroy(g_contended);
+        write_str("Lock stats: SUCCESS - not compiled in (make LOCKSTATS=1)\n");
+        return;
+    }
+    heap_destroy(g_contended);
+
+    /* every lock taken is counted, every wait lands in one bucket */
+    bucketed = 0;
+    for (i = 0; i < LOCK_STAT_BUCKETS; i++)
+        bucketed += stats.buckets[i];
+    if (stats.acquisitions < 2ULL * CONTENTION_THREADS * CONTENTION_ROUNDS ||
+        stats.contended == 0 || stats.contended > stats.acquisitions ||
+        bucketed != stats.contended || stats.spin_acquired > stats.contended ||
+        stats.max_wait_ns == 0 || stats.max_wait_ns > stats.total_wait_ns ||
+        stats.max_wait_ns * stats.contended < stats.total_wait_ns)
+        ok = 0;
+
+    if (ok)
+        write_str("Lock stats: SUCCESS - contended waits counted and bucketed\n");
+    else
+        write_str("Lock stats: FAILED contention statistics inconsistent\n");
+}
+
+
+void test_purge(void)
+{
+    char            *ptrs[100];
+    unsigned char   resident;
+    char            *page;
+    int             i;
+    int             ok = 1;
+
+    for (i = 0; i < 100; i++)
+    {
+        ptrs[i] = malloc(SMALL_ALLOC_SIZE * 2 - 100);
+        memset(ptrs[i], 'x', SMALL_ALLOC_SIZE * 2 - 100);
+    }
+    g_keep = ptrs[0];
+
+    /* keep both ends alive, free everything in between */
+    for (i = 1; i < 99; i++)
+        free(ptrs[i]);
+
+    /* a page in the middle of the freed span must no longer be resident */
+    page = (char *)(((uintptr_t)ptrs[50]) & ~((uintptr_t)getpagesize() - 1));
+    if (mincore(page, getpagesize(), &resident) != 0 || (resident & 1))
+        ok = 0;
+    if (ptrs[0][0] != 'x' || ptrs[99][SMALL_ALLOC_SIZE] != 'x')
+        ok = 0;
+
+    /* and the span is reusable */
+    ptrs[50] = malloc(SMALL_ALLOC_SIZE);
+    memset(ptrs[50], 'y', SMALL_ALLOC_SIZE);
+    free(ptrs[50]);
+    free(ptrs[0]);
+    free(ptrs[99]);
+
+    if (ok)
+        write_str("Purge: SUCCESS - interior free pages released\n");
+    else
+        write_str("Purge: FAILED interior pages still resident\n");
+}
+
+
+void test_analyze(void)
+{
+    t_heap          *heap;
+    t_heap_report   report;
+    t_pool          *pool;
+    void            *ptrs[10];
+    int             i;
+    int             ok = 1;
+
+    heap = heap_create();
+    for (i = 0; i < 10; i++)
+        ptrs[i] = heap_malloc(heap, TINY_ALLOC_SIZE);
+    for (i = 0; i < 10; i += 2)
+        heap_free(heap, ptrs[i]);
+
+    /* 5 live TINY blocks, the freed ones scattered between them */
+    if (malloc_analyze(heap, &report, NULL) != 0 || report.zones[TINY] != 1 ||
+        report.live_blocks != 5 || report.live_bytes < 5 * TINY_ALLOC_SIZE ||
+        report.free_blocks != 6 || report.external_fragmentation <= 0.0 ||
+        report.reclaimable_bytes != 0)
+        ok = 0;
+
+    /* a zone with nothing live left could go back to the system */
+    for (i = 1; i < 10; i += 2)
+        heap_free(heap, ptrs[i]);
+    if (malloc_analyze(heap, &report, NULL) != 0 ||
+        (report.zones[TINY] && report.reclaimable_bytes < report.mapped_bytes))
+        ok = 0;
+    heap_destroy(heap);
+
+    /* the global analysis tells objects handed out from those in magazines */
+    pool = pool_create_flags(32, 0, POOL_MAGAZINES);
+    for (i = 0; pool && i < 10; i++)
+        ptrs[i] = pool_alloc(pool);
+    if (!pool || malloc_analyze(NULL, &report, NULL) != 0 ||
+        report.pool_live_bytes < 10 * 32 || report.pool_magazine_bytes < 6 * 32 ||
+        report.pool_bytes < report.pool_live_bytes + report.pool_magazine_bytes)
+        ok = 0;
+    pool_destroy(pool);
+
+    if (ok)
+        write_str("Analyze: SUCCESS - live, free, reclaimable and pool bytes reported\n");
+    else
+        write_str("Analyze: FAILED report mismatch\n");
+}
+
+void test_reserve(void)
+{
+    unsigned char   resident;
+    uintptr_t       first;
+    char            *ptr;
+    int             ok = 1;
+
+    malloc_set_thread_policy(MALLOC_POLICY_RESERVE_ONLY);
+
+    /* nothing reserved yet: fail fast instead of mapping */
+    g_keep = malloc(300000);
+    if (g_keep)
+        ok = 0;
+    free(g_keep);
+
+    /* a reserved zone is pre-faulted and reused after free */
+    if (malloc_reserve(0, 0, 300000, 1, 0) != 0)
+        ok = 0;
+    ptr = malloc(300000);
+    if (!ptr || mincore((void *)(((uintptr_t)ptr + 200000) & ~((uintptr_t)getpagesize() - 1)),
+            getpagesize(), &resident) != 0 || !(resident & 1))
+        ok = 0;
+    first = (uintptr_t)ptr;
+    free(ptr);
+    ptr = malloc(300000);
+    if ((uintptr_t)ptr != first)
+        ok = 0;
+    free(ptr);
+
+    malloc_set_thread_policy(MALLOC_POLICY_DEFAULT);
+
+    if (ok)
+        write_str("Reserve: SUCCESS - reserve-only thread served from pre-faulted zones\n");
+    else
+        write_str("Reserve: FAILED reserve-only allocation touched the kernel\n");
+}
+
+void test_numa(void)
+{
+    t_numa_stats    stats;
+    char            *ptr;
+    int             last;
+    int             ok = 1;
+
+    /* allocate on the last node's arena, free from the default one */
+    malloc_numa_stats(&stats);
+    last = stats.nodes - 1;
+    if (stats.nodes < 1 || malloc_numa_bind_thread(stats.nodes) != -1 ||
+        malloc_numa_bind_thread(last) != 0)
+        ok = 0;
+    ptr = malloc(SMALL_ALLOC_SIZE);
+    memset(ptr, 'n', SMALL_ALLOC_SIZE);
+    g_keep = realloc(ptr, SMALL_ALLOC_SIZE * 2);
+    malloc_numa_bind_thread(-1);
+
+    malloc_numa_stats(&stats);
+    if (stats.zones_local[last] + stats.zones_remote[last] == 0 ||
+        ((char *)g_keep)[SMALL_ALLOC_SIZE - 1] != 'n')
+        ok = 0;
+    free(g_keep);
+
+    if (ok)
+        write_str("NUMA: SUCCESS - node arena placement reported\n");
+    else
+        write_str("NUMA: FAILED node arena placement\n");
+}
+
+/*
+ * arenas: a copy of this program run with FT_MALLOC_NUMA_NODES=2 allocates
+ * from a thread on node 1 and frees from node 0
+ */
+#define NUMA_CHILD "numa_arenas"
+#define NUMA_BLOCKS 64
+
+static void *g_remote[NUMA_BLOCKS];
+
+static size_t numa_block_size(int i)
+{
+    static const size_t sizes[] = {TINY_ALLOC_SIZE, SMALL_ALLOC_SIZE, 3 * 4096, MEDIUM_MAX + 4096};
+
+    return (sizes[i % 4]);
+}
+
+static void *numa_alloc_routine(void *arg)
+{
+    int i;
+
+    (void)arg;
+    malloc_numa_bind_thread(1);
+    for (i = 0; i < NUMA_BLOCKS; i++)
+    {
+        g_remote[i] = malloc(numa_block_size(i));
+        if (g_remote[i])
+            memset(g_remote[i], i, numa_block_size(i));
+    }
+    return NULL;
+}
+
+static size_t numa_zones(int node)
+{
+    t_numa_stats    stats;
+
+    malloc_numa_stats(&stats);
+    return (stats.zones_local[node] + stats.zones_remote[node]);
+}
+
+static int numa_arenas_child(void)
+{
+    t_numa_stats    stats;
+    pthread_t       thread;
+    size_t          before;
+    char            *grown;
+    int             i;
+
+    malloc_numa_stats(&stats);
+    if (stats.nodes != 2)
+        return 1;
+    pthread_create(&thread, NULL, numa_alloc_routine, NULL);
+    pthread_join(thread, NULL);
+    before = numa_zones(1);
+
+    /* node 0 finds the blocks of node 1 */
+    malloc_numa_bind_thread(0);
+    for (i = 0; i < NUMA_BLOCKS; i++)
+    {
+        if (!g_remote[i] || malloc_usable_size(g_remote[i]) < numa_block_size(i))
+            return 1;
+    }
+    grown = realloc(g_remote[0], SMALL_ALLOC_SIZE * 2);
+    if (!grown || grown[TINY_ALLOC_SIZE - 1] != 0)
+        return 1;
+    g_remote[0] = grown;
+
+    /* and gives them back to it: its LARGE zones are unmapped */
+    for (i = 0; i < NUMA_BLOCKS; i++)
+        free(g_remote[i]);
+    if (numa_zones(1) + NUMA_BLOCKS / 4 > before)
+        return 1;
+    return 0;
+}
+
+void test_numa_arenas(void)
+{
+    pid_t   pid;
+    int     status;
+
+    if (threads_forbidden("NUMA arenas"))
+        return;
+    pid = fork();
+    if (pid == 0)
+    {
+        setenv("FT_MALLOC_NUMA_NODES", "2", 1);
+        execl("/proc/self/exe", "test_malloc", NUMA_CHILD, (char *)NULL);
+        _exit(2);
+    }
+    if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0)
+        write_str("NUMA arenas: SUCCESS - blocks freed across arenas\n");
+    else
+        write_str("NUMA arenas: FAILED cross-arena free\n");
+}
+
+void test_calloc(void)
+{
+    unsigned char   resident;
+    char            *ptrs[20];
+    char            *big;
+    char            *moved;
+    size_t          i;
+    size_t          j;
+    volatile size_t huge;
+    int             ok = 1;
+
+    /* dirty blocks (some of them purged) come back zeroed */
+    for (i = 0; i < 20; i++)
+    {
+        ptrs[i] = malloc(SMALL_ALLOC_SIZE * 2 - 100);
+        memset(ptrs[i], 0xab, SMALL_ALLOC_SIZE * 2 - 100);
+    }
+    for (i = 1; i < 19; i++)
+        free(ptrs[i]);
+    for (i = 1; i < 19; i++)
+        ptrs[i] = calloc(i, 97);
+    for (i = 1; i < 19; i++)
+    {
+        for (j = 0; j < i * 97; j++)
+            if (ptrs[i][j] != 0)
+                ok = 0;
+    }
+    for (i = 0; i < 20; i++)
+        free(ptrs[i]);
+
+    /* a fresh LARGE mapping is not touched to zero it */
+    big = calloc(16, 1024 * 1024);
+    if (!big || mincore((void *)(((uintptr_t)big + 8 * 1024 * 1024) & ~((uintptr_t)getpagesize() - 1)),
+            getpagesize(), &resident) != 0 || (resident & 1))
+        ok = 0;
+    if (big && (big[0] != 0 || big[16 * 1024 * 1024 - 1] != 0))
+        ok = 0;
+    free(big);
+
+    /* nmemb * size overflowing is refused */
+    huge = (size_t)-1;
+    if (calloc(huge, 2) != NULL)
+        ok = 0;
+
+    /* so are sizes that would wrap once headers and alignment are added */
+    huge = (size_t)-1 - 8;
+    if (calloc(1, huge) != NULL || malloc(huge) != NULL || malloc(huge - 4096) != NULL)
+        ok = 0;
+    big = malloc(TINY_ALLOC_SIZE);
+    if (!big)
+        ok = 0;
+    else
+    {
+        memset(big, 0x5a, TINY_ALLOC_SIZE);
+        moved = realloc(big, huge);
+        if (moved != NULL)
+        {
+            ok = 0;
+            big = moved;
+        }
+        else if (big[TINY_ALLOC_SIZE - 1] != 0x5a)
+            ok = 0;
+        free(big);
+    }
+
+    if (ok)
+        write_str("Calloc: SUCCESS - zeroed, fresh pages left untouched\n");
+    else
+        write_str("Calloc: FAILED memory not zeroed, touched needlessly or oversized request served\n");
+}
+
+void test_medium(void)
+{
+    t_heap_report   before;
+    t_heap_report   after;
+    char            *ptrs[64];
+    size_t          size;
+    int             i;
+    int             ok = 1;
+
+    malloc_analyze(NULL, &before, NULL);
+    for (i = 0; i < 64; i++)
+    {
+        size = 1100 + (size_t)i * 700;
+        ptrs[i] = malloc(size);
+        memset(ptrs[i], i, size);
+    }
+    malloc_analyze(NULL, &after, NULL);
+
+    /* 64 requests between 1 KB and 45 KB share a handful of chunks */
+    if (after.zones[LARGE] != before.zones[LARGE] ||
+        after.zones[MEDIUM] - before.zones[MEDIUM] > 16)
+        ok = 0;
+
+    /* freed runs are reused from the bins, not from new chunks */
+    for (i = 0; i < 64; i += 2)
+        free(ptrs[i]);
+    for (i = 0; i < 64; i += 2)
+    {
+        ptrs[i] = malloc(1100 + (size_t)i * 700);
+        memset(ptrs[i], i, 1100 + (size_t)i * 700);
+    }
+    malloc_analyze(NULL, &before, NULL);
+    if (before.zones[MEDIUM] != after.zones[MEDIUM])
+        ok = 0;
+
+    /* a pointer into the middle of a run is not one, free ignores it */
+    free(ptrs[63] + getpagesize());
+    g_keep = malloc(1100 + 63 * 700);
+    if ((char *)g_keep > ptrs[63] && (char *)g_keep < ptrs[63] + 1100 + 63 * 700)
+        ok = 0;
+    free(g_keep);
+
+    for (i = 0; i < 64; i++)
+    {
+        if (ptrs[i][0] != (char)i || ptrs[i][1100 + i * 700 - 1] != (char)i)
+            ok = 0;
+        free(ptrs[i]);
+    }
+
+    if (ok)
+        write_str("Medium: SUCCESS - 1-45 KB served from shared chunks\n");
+    else
+        write_str("Medium: FAILED medium allocations mapped separately\n");
+}
+
+/* poll the background stats until ready zones reach count, up to 2s */
+static int wait_ready(t_background_stats *stats, size_t prepared)
+{
+    int tries;
+
+    for (tries = 0; tries < 200; tries++)
+    {
+        malloc_background_stats(stats);
+        if (stats->zones_prepared >= prepared &&
+            stats->zones_ready >= BACKGROUND_READY_ZONES)
+            return 1;
+        usleep(10000);
+    }
+    return 0;
+}
+
+void test_background(void)
+{
+    t_background_stats  stats;
+    char                *ptrs[800];
+    t_heap              *heap;
+    size_t              prepared;
+    pid_t               pid;
+    int                 status;
+    int                 i;
+    int                 ok = 1;
+
+    if (threads_forbidden("Background"))
+    {
+        if (malloc_background(1) != -1)
+            write_str("Background: FAILED thread allowed in a SINGLE_THREADED=1 build\n");
+        return;
+    }
+    /* the first zone created after enabling starts the thread */
+    if (malloc_background(1) != 0)
+        ok = 0;
+    for (i = 0; i < 400; i++)
+        ptrs[i] = malloc(TINY_ALLOC_SIZE);
+    if (!wait_ready(&stats, 1) || !stats.running)
+        ok = 0;
+
+    /* taking ready zones has them replaced */
+    prepared = stats.zones_prepared;
+    for (i = 400; i < 800; i++)
+        ptrs[i] = malloc(TINY_ALLOC_SIZE);
+    if (!wait_ready(&stats, prepared + 1))
+        ok = 0;
+
+    /* a child has no thread but keeps allocating */
+    pid = fork();
+    if (pid == 0)
+    {
+        for (i = 0; i < 800; i++)
+            free(ptrs[i]);
+        for (i = 0; i < 800; i++)
+            ptrs[i] = malloc(TINY_ALLOC_SIZE);
+        _exit(0);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+        ok = 0;
+
+    for (i = 0; i < 800; i++)
+        free(ptrs[i]);
+
+    /* a heap's emptied zones are unmapped, never kept as ready zones */
+    heap = heap_create();
+    for (i = 0; heap && i < 800; i++)
+        ptrs[i] = heap_malloc(heap, TINY_ALLOC_SIZE);
+    for (i = 0; heap && i < 800; i++)
+        heap_free(heap, ptrs[i]);
+    if (!heap || heap->ready_count[TINY] || heap->ready[TINY])
+        ok = 0;
+    if (heap)
+        heap_destroy(heap);
+
+    /* stopping joins the thread and returns the ready zones */
+    malloc_background(0);
+    malloc_background_stats(&stats);
+    if (stats.running || stats.zones_ready)
+        ok = 0;
+
+    if (ok)
+        write_str("Background: SUCCESS - ready zones pre-faulted off the request path\n");
+    else
+        write_str("Background: FAILED background thread did not keep zones ready\n");
+}
+
+/* write a fake cgroup or PSI file */
+static void write_file(const char *dir, const char *name, const char *content)
+{
+    char    path[256];
+    int     fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    if (write(fd, content, strlen(content)) < 0)
+        write_str("Pressure: could not write fake file\n");
+    close(fd);
+}
+
+static void remove_file(const char *dir, const char *name)
+{
+    char    path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    unlink(path);
+}
+
+static int g_empty_zones;
+
+static void count_empty_zone(const t_zone_report *zone)
+{
+    if (zone->zone_type != LARGE && zone->live_bytes == 0 && !zone->bootstrap)
+        g_empty_zones++;
+}
+
+void test_pressure(void)
+{
+    t_pressure_stats    stats;
+    t_heap_report       report;
+    char                dir[] = "/tmp/ft_pressureXXXXXX";
+    char                psi[300];
+    int                 ok = 1;
+
+    if (!mkdtemp(dir))
+    {
+        write_str("Pressure: FAILED could not create fake cgroup\n");
+        return;
+    }
+    snprintf(psi, sizeof(psi), "%s/pressure", dir);
+    write_file(dir, "memory.max", "1000000\n");
+    write_file(dir, "pressure", "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+        "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+
+    /* plenty of headroom and no stalls */
+    write_file(dir, "memory.current", "100000\n");
+    if (malloc_pressure_config(dir, psi) != MALLOC_PRESSURE_LOW)
+        ok = 0;
+
+    /* close to the limit: empty zones and free pages are handed back */
+    write_file(dir, "memory.current", "990000\n");
+    if (malloc_pressure_config(dir, psi) != MALLOC_PRESSURE_HIGH)
+        ok = 0;
+    g_empty_zones = 0;
+    malloc_analyze(NULL, &report, count_empty_zone);
+    malloc_pressure_stats(&stats);
+    if (g_empty_zones != 0 || stats.shrinks == 0 || stats.limit != 1000000)
+        ok = 0;
+
+    /* stalls alone are enough */
+    write_file(dir, "pressure", "some avg10=25.00 avg60=3.00 avg300=1.00 total=99\n");
+    if (malloc_pressure_config("", psi) != MALLOC_PRESSURE_HIGH)
+        ok = 0;
+
+    /*
+     * nothing to watch; left that way, so later tests do not depend on
+     * the load of the machine running them
+     */
+    if (malloc_pressure_config("", "") != MALLOC_PRESSURE_NORMAL)
+        ok = 0;
+    remove_file(dir, "memory.max");
+    remove_file(dir, "memory.current");
+    remove_file(dir, "pressure");
+    rmdir(dir);
+
+    if (ok)
+        write_str("Pressure: SUCCESS - retention follows cgroup and PSI readings\n");
+    else
+        write_str("Pressure: FAILED pressure levels not derived from the files\n");
+}
+
+static t_pool *g_pool;
+
+static void *pool_churn_routine(void *arg)
+{
+    void    *objs[100];
+    int     round;
+    int     i;
+
+    (void)arg;
+    for (round = 0; round < 1000; round++)
+    {
+        for (i = 0; i < 100; i++)
+        {
+            objs[i] = pool_alloc(g_pool);
+            memset(objs[i], round, 40);
+        }
+        for (i = 0; i < 100; i++)
+            pool_free(g_pool, objs[i]);
+    }
+    return NULL;
+}
+
+void test_pool(void)
+{
+    t_pool_stats    stats;
+    pthread_t       threads[4];
+    char            *objs[200];
+    char            *last;
+    int             i;
+    int             ok = 1;
+
+    if (threads_forbidden("Pool"))
+        return;
+    /* aligned, distinct objects, reused last freed first */
+    g_pool = pool_create(40, 64);
+    for (i = 0; i < 200; i++)
+    {
+        objs[i] = pool_alloc(g_pool);
+        if (!objs[i] || ((uintptr_t)objs[i] & 63) || (i > 0 && objs[i] == objs[i - 1]))
+            ok = 0;
+        memset(objs[i], i, 40);
+    }
+    for (i = 0; i < 200; i++)
+        if (objs[i][39] != (char)i)
+            ok = 0;
+    last = objs[150];
+    pool_free(g_pool, objs[10]);
+    pool_free(g_pool, last);
+    if (pool_alloc(g_pool) != last || pool_alloc(g_pool) != objs[10])
+        ok = 0;
+    pool_stats(g_pool, &stats);
+    if (stats.obj_size != 64 || stats.in_use != 200 || stats.capacity < 200)
+        ok = 0;
+    for (i = 0; i < 200; i++)
+        pool_free(g_pool, objs[i]);
+    pool_destroy(g_pool);
+
+    /* magazines go back to the pool when their threads exit */
+    g_pool = pool_create_flags(40, 0, POOL_MAGAZINES);
+    for (i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, pool_churn_routine, NULL);
+    for (i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+    pool_stats(g_pool, &stats);
+    if (stats.in_use != 0 || stats.magazine_refills == 0 || stats.zones != 1)
+        ok = 0;
+    pool_destroy(g_pool);
+
+    if (ok)
+        write_str("Pool: SUCCESS - fixed-size objects recycled LIFO, magazines flushed\n");
+    else
+        write_str("Pool: FAILED pool objects lost or misaligned\n");
+}
+
+/* a node of a list built by offsets only */
+typedef struct s_shm_node {
+    t_shm_off next;
+    void *mapped_at;
+    char text[32];
+} t_shm_node;
+
+void test_shm(void)
+{
+    t_shm_heap  *heap;
+    t_shm_heap  *other;
+    t_shm_node  *node;
+    t_shm_off   off;
+    pid_t       pid;
+    int         status;
+    int         count;
+    int         fd;
+    int         ok = 1;
+
+    heap = shm_heap_create(NULL, 1 << 20);
+    if (!heap)
+    {
+        write_str("Shm: FAILED could not create the region\n");
+        return;
+    }
+
+    /* the child maps the region again, at another address, and builds a list */
+    pid = fork();
+    if (pid == 0)
+    {
+        other = shm_heap_attach(dup(shm_heap_fd(heap)));
+        if (!other || other->base == heap->base)
+            _exit(1);
+        for (count = 0; count < 3; count++)
+        {
+            off = shm_malloc(other, sizeof(t_shm_node));
+            if (!off)
+                _exit(1);
+            node = shm_ptr(other, off);
+            node->next = shm_get_root(other);
+            node->mapped_at = other->base;
+            strcpy(node->text, "from the child");
+            shm_set_root(other, off);
+        }
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        ok = 0;
+
+    /* the parent follows the offsets through its own mapping */
+    count = 0;
+    off = shm_get_root(heap);
+    while (off)
+    {
+        node = shm_ptr(heap, off);
+        if (strcmp(node->text, "from the child") != 0 || node->mapped_at == (void *)heap->base ||
+            shm_offset(heap, node) != off)
+            ok = 0;
+        off = node->next;
+        shm_free(heap, shm_offset(heap, node));
+        count++;
+    }
+    shm_set_root(heap, 0);
+    if (count != 3)
+        ok = 0;
+
+    /* a process dying with the lock held does not wedge the others */
+    pid = fork();
+    if (pid == 0)
+    {
+        pthread_mutex_lock(&heap->base->mutex);
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+
+    /* everything was freed and coalesced: one block spans the zone again */
+    off = shm_malloc(heap, (1 << 20) - 4096);
+    if (!off)
+        ok = 0;
+    shm_free(heap, off);
+    shm_heap_close(heap);
+
+    /* a named heap that cannot be made takes its name with it */
+    shm_unlink("/ft_malloc_test_fail");
+    if (shm_heap_create("/ft_malloc_test_fail", MAX_ALLOC_SIZE))
+        ok = 0;
+    fd = shm_open("/ft_malloc_test_fail", O_RDWR, 0);
+    if (fd >= 0)
+    {
+        ok = 0;
+        close(fd);
+        shm_unlink("/ft_malloc_test_fail");
+    }
+
+    if (ok)
+        write_str("Shm: SUCCESS - offset-linked objects shared across mappings\n");
+    else
+        write_str("Shm: FAILED shared heap not usable across processes\n");
+}
+
+#define SHM_FREE_COUNT 16384
+#define SHM_FREE_SLICE 1024
+
+/* nanoseconds taken to free offs[from..from+SHM_FREE_SLICE) from the top down */
+static long time_shm_frees(t_shm_heap *heap, t_shm_off *offs, int from)
+{
+    struct timespec start;
+    struct timespec end;
+    int             i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = from + SHM_FREE_SLICE - 1; i >= from; i--)
+        shm_free(heap, offs[i]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec);
+}
+
+void test_shm_free(void)
+{
+    static t_shm_off    offs[SHM_FREE_COUNT];
+    t_shm_heap          *heap;
+    t_shm_off           extra;
+    long                top;
+    long                bottom;
+    int                 ok;
+    int                 i;
+
+    ok = 1;
+    extra = 0;
+    heap = shm_heap_create(NULL, SHM_FREE_COUNT * BLOCK_SIZE(64) + (1 << 20));
+    if (!heap)
+    {
+        write_str("Shm free: FAILED could not create the heap\n");
+        return;
+    }
+    for (i = 0; i < SHM_FREE_COUNT; i++)
+        if (!(offs[i] = shm_malloc(heap, 64)))
+            ok = 0;
+
+    /* offsets that do not name a live block leave the heap alone */
+    if (ok)
+    {
+        shm_free(heap, offs[10] + 16);
+        shm_free(heap, offs[10] - 8);
+        shm_free(heap, offs[10] + BLOCK_SIZE(64) / 2);
+        shm_free(heap, 1);
+        shm_free(heap, offs[11]);
+        shm_free(heap, offs[11]);
+        if (!(offs[11] = shm_malloc(heap, 64)) || !(extra = shm_malloc(heap, 4 * BLOCK_SIZE(64))))
+            ok = 0;
+        shm_free(heap, extra);
+    }
+
+    /*
+     * each free used to walk every block below it, so the top slice cost
+     * far more than the bottom one. Now both are O(1)
+     */
+    if (ok)
+    {
+        top = time_shm_frees(heap, offs, SHM_FREE_COUNT - SHM_FREE_SLICE);
+        for (i = SHM_FREE_COUNT - SHM_FREE_SLICE - 1; i >= SHM_FREE_SLICE; i--)
+            shm_free(heap, offs[i]);
+        bottom = time_shm_frees(heap, offs, 0);
+        if (top > bottom * 4 + 1000000)
+            ok = 0;
+    }
+
+    /* everything coalesced back into one block spanning the zone */
+    if (ok && !shm_malloc(heap, SHM_FREE_COUNT * BLOCK_SIZE(64)))
+        ok = 0;
+    shm_heap_close(heap);
+
+    if (ok)
+        write_str("Shm free: SUCCESS - stray offsets ignored, frees are O(1)\n");
+    else
+        write_str("Shm free: FAILED stray offset freed or frees grow with the heap\n");
+}
+
+static void *g_zone_of_ptr;
+static void *g_zone_found;
+
+static void find_zone_of(const t_zone_report *zone)
+{
+    if ((char *)g_zone_of_ptr >= (char *)zone->zone &&
+        (char *)g_zone_of_ptr < (char *)zone->zone + zone->zone_size)
+        g_zone_found = zone->zone;
+}
+
+/* the zone holding ptr, from the analyzer's zone walk */
+static t_zone *zone_of(void *ptr)
+{
+    t_heap_report   report;
+
+    g_zone_of_ptr = ptr;
+    g_zone_found = NULL;
+    malloc_analyze(NULL, &report, find_zone_of);
+    return (g_zone_found);
+}
+
+#ifdef MALLOC_LIFETIME_FRAMES
+/* a shared allocation wrapper, kept out of line and out of tail position */
+static __attribute__((noinline)) void *lifetime_wrapper(size_t size)
+{
+    char    *ptr;
+
+    ptr = malloc(size);
+    if (ptr)
+        ptr[0] = 0;
+    return (ptr);
+}
+
+static __attribute__((noinline)) void *wrapper_keeps(void)
+{
+    void    *ptr;
+
+    ptr = lifetime_wrapper(TINY_ALLOC_SIZE);
+    g_keep = ptr;
+    return (ptr);
+}
+
+static __attribute__((noinline)) void wrapper_churns(void)
+{
+    g_keep = lifetime_wrapper(TINY_ALLOC_SIZE);
+    free(g_keep);
+}
+#endif
+
+void test_lifetime(void)
+{
+    static void         *kept[4000];
+    t_lifetime_stats    stats;
+    void                *short_lived[200];
+    void                *moved;
+    t_zone              *zone;
+    void                *long_lived[200];
+    int                 i;
+    int                 j;
+    int                 ok = 1;
+#ifdef MALLOC_LIFETIME_FRAMES
+    t_lifetime_stats    before;
+#endif
+
+    /* interleaved hinted blocks end up in zones of their own */
+    for (i = 0; i < 200; i++)
+    {
+        short_lived[i] = malloc_hinted(TINY_ALLOC_SIZE, MALLOC_HINT_SHORT_LIVED);
+        long_lived[i] = malloc_hinted(TINY_ALLOC_SIZE, MALLOC_HINT_LONG_LIVED);
+        if (!short_lived[i] || !long_lived[i])
+            ok = 0;
+    }
+    malloc_lifetime_stats(&stats);
+    if (stats.zones[LIFETIME_SHORT] == 0 || stats.zones[LIFETIME_LONG] == 0)
+        ok = 0;
+
+    /* the long-lived survivors no longer pin the short-lived zones */
+    for (i = 0; i < 200; i++)
+        free(short_lived[i]);
+    malloc_lifetime_stats(&stats);
+    if (stats.zones[LIFETIME_SHORT] != 0 || stats.zones[LIFETIME_LONG] == 0)
+        ok = 0;
+    for (i = 0; i < 200; i++)
+        free(long_lived[i]);
+
+    /* call sites learn from their samples: one site churns, one keeps */
+    malloc_lifetime_predict(1);
+    for (i = 0; i < 4000; i++)
+    {
+        kept[i] = malloc(TINY_ALLOC_SIZE);
+        for (j = 0; j < 8; j++)
+        {
+            g_keep = malloc(TINY_ALLOC_SIZE);
+            free(g_keep);
+        }
+    }
+    malloc_lifetime_stats(&stats);
+    if (stats.samples == 0 || stats.sites_short == 0 || stats.sites_long == 0)
+        ok = 0;
+    for (i = 0; i < 4000; i++)
+        free(kept[i]);
+
+#ifdef MALLOC_LIFETIME_FRAMES
+    /* sites behind one wrapper are told apart by the wrapper's callers */
+    malloc_lifetime_stats(&before);
+    for (i = 0; i < 4000; i++)
+    {
+        kept[i] = wrapper_keeps();
+        for (j = 0; j < 8; j++)
+            wrapper_churns();
+    }
+    malloc_lifetime_stats(&stats);
+    if (stats.sites_short <= before.sites_short || stats.sites_long <= before.sites_long)
+        ok = 0;
+    for (i = 0; i < 4000; i++)
+        free(kept[i]);
+#endif
+    malloc_lifetime_predict(0);
+
+    /*
+     * a hinted block moved by realloc stays in its lifetime class; live
+     * neighbours on both sides keep it from growing in place
+     */
+    for (i = 0; i < 16; i++)
+        short_lived[i] = malloc_hinted(TINY_ALLOC_SIZE, MALLOC_HINT_LONG_LIVED);
+    for (i = 1; i < 15; i++)
+        if ((char *)short_lived[i] - (char *)short_lived[i - 1] == BLOCK_SIZE(TINY_ALLOC_SIZE) &&
+            (char *)short_lived[i + 1] - (char *)short_lived[i] == BLOCK_SIZE(TINY_ALLOC_SIZE))
+            break;
+    moved = (i < 15) ? realloc(short_lived[i], SMALL_ALLOC_SIZE) : NULL;
+    zone = zone_of(moved);
+    if (!moved || moved == short_lived[i] || !zone || zone->zone_type != SMALL ||
+        zone->lifetime != LIFETIME_LONG)
+        ok = 0;
+    if (moved)
+        short_lived[i] = moved;
+    for (i = 0; i < 16; i++)
+        free(short_lived[i]);
+
+    if (ok)
+        write_str("Lifetime: SUCCESS - short and long-lived blocks kept in separate zones\n");
+    else
+        write_str("Lifetime: FAILED lifetime classes mixed or not predicted\n");
+}
+
+
+static size_t g_bootstrap_bytes[2];
+
+static void find_bootstrap_zone(const t_zone_report *zone)
+{
+    if (zone->bootstrap && zone->zone_type <= SMALL)
+        g_bootstrap_bytes[zone->zone_type] = zone->zone_size;
+}
+
+void test_bootstrap(void)
+{
+    t_heap_report   report;
+    void            *ptrs[50];
+    int             i;
+
+    /* the static zones are in the lists from the start and survive purging */
+    for (i = 0; i < 50; i++)
+        ptrs[i] = malloc(i % 2 ? TINY_ALLOC_SIZE : SMALL_ALLOC_SIZE);
+    for (i = 0; i < 50; i++)
+        free(ptrs[i]);
+    malloc_purge();
+    malloc_analyze(NULL, &report, find_bootstrap_zone);
+
+    if (g_bootstrap_bytes[TINY] == BOOTSTRAP_TINY_SIZE && g_bootstrap_bytes[SMALL] == BOOTSTRAP_SMALL_SIZE)
+        write_str("Bootstrap: SUCCESS - static TINY/SMALL zones serve startup allocations\n");
+    else
+        write_str("Bootstrap: FAILED static zones missing\n");
+}
+
+
+int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], NUMA_CHILD) == 0)
+        return (numa_arenas_child());
     write_str("=== Testing malloc implementation===\n");
 
+    test_single_threaded();
     test_multithreaded();
+    test_heaps();
+    test_fork_safety();
+    test_large_registry();
+    test_realloc_in_place();
+    test_realloc_growth();
+    test_trace();
+    test_lock_stats();
+    test_purge();
+    test_analyze();
+    test_reserve();
+    test_numa();
+    test_numa_arenas();
+    test_calloc();
+    test_medium();
+    test_background();
+    test_pressure();
+    test_pool();
+    test_shm();
+    test_shm_free();
+    test_lifetime();
+    test_bootstrap();
 
     write_str("=== Testing complete ===\n");
 }
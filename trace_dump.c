@@ -0,0 +1,99 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   trace_dump.c                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: Joseph Kiragu                              +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2025-05             by Joseph           #+#    #+#             */
+/*   Updated: 2025-05             by Joseph          ###   ########.adl       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "inc/malloc_trace.h"
+
+/*
+ * print the records of a trace ring written by a process running the
+ * allocator with tracing enabled, oldest first. a ring whose process is
+ * gone (kept with FT_MALLOC_TRACE_KEEP=1, or left by a crash) is removed
+ * once printed
+ * usage: ./trace_dump /dev/shm/ft_malloc_trace.<pid>.<tid>
+ */
+
+static const char *event_name(uint32_t type)
+{
+    if (type == TRACE_ZONE_CREATE)
+        return "zone_create";
+    if (type == TRACE_ZONE_UNMAP)
+        return "zone_unmap";
+    if (type == TRACE_LARGE_ALLOC)
+        return "large_alloc";
+    if (type == TRACE_LARGE_FREE)
+        return "large_free";
+    if (type == TRACE_LOCK_WAIT)
+        return "lock_wait";
+    return "unknown";
+}
+
+
+int main(int argc, char **argv)
+{
+    int                 fd;
+    const t_trace_ring  *ring;
+    t_trace_record      record;
+    uint64_t            head;
+    uint64_t            i;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <trace ring file>\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    ring = mmap(NULL, TRACE_RING_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    if (ring->magic != TRACE_MAGIC || ring->version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: not a trace ring\n", argv[1]);
+        return 1;
+    }
+
+    /* the writer may still be running: snapshot head, then copy records */
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    i = head > ring->capacity ? head - ring->capacity : 0;
+    printf("# tsc type tid size duration\n");
+    for (; i < head; i++)
+    {
+        record = ring->records[i % ring->capacity];
+        printf("%lu %s %u %lu %lu\n", (unsigned long)record.tsc,
+            event_name(record.type), record.tid,
+            (unsigned long)record.size, (unsigned long)record.duration);
+    }
+    if (head > ring->capacity)
+        fprintf(stderr, "%lu older records were overwritten\n",
+            (unsigned long)(head - ring->capacity));
+
+    if (ring->pid && kill((pid_t)ring->pid, 0) != 0 && errno == ESRCH &&
+        unlink(argv[1]) == 0)
+        fprintf(stderr, "process %u has exited, %s removed\n", ring->pid, argv[1]);
+
+    munmap((void *)ring, TRACE_RING_BYTES);
+    return 0;
+}